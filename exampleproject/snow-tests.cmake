@@ -0,0 +1,38 @@
+# Writes an add_test for each test case in TEST_BINARY to TESTS_FILE,
+# from the output of 'TEST_BINARY --list --format=json'.
+# Tags become the tests' labels. Run with cmake -P.
+
+cmake_minimum_required(VERSION 3.19)
+
+execute_process(
+	COMMAND "${TEST_BINARY}" --list --format=json
+	OUTPUT_VARIABLE json
+	RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "${TEST_BINARY} --list --format=json failed")
+endif()
+
+set(content "")
+string(JSON count LENGTH "${json}")
+if(count GREATER 0)
+	math(EXPR last "${count} - 1")
+	foreach(i RANGE ${last})
+		string(JSON id GET "${json}" ${i} id)
+		string(APPEND content
+			"add_test([==[${id}]==] \"${TEST_BINARY}\" --run-id [==[${id}]==])\n")
+
+		string(JSON num_tags LENGTH "${json}" ${i} tags)
+		if(num_tags GREATER 0)
+			set(labels "")
+			math(EXPR last_tag "${num_tags} - 1")
+			foreach(j RANGE ${last_tag})
+				string(JSON tag GET "${json}" ${i} tags ${j})
+				list(APPEND labels "${tag}")
+			endforeach()
+			string(APPEND content
+				"set_tests_properties([==[${id}]==] PROPERTIES LABELS [==[${labels}]==])\n")
+		endif()
+	endforeach()
+endif()
+
+file(WRITE "${TESTS_FILE}" "${content}")
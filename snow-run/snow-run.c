@@ -0,0 +1,594 @@
+/*
+ * snow-run: run many Snow test binaries in parallel, and merge their
+ * results into one summary.
+ *
+ * Each test binary gets a pipe, whose fd is passed in SNOW_RESULT_FD,
+ * and Snow writes a line to it for each test case (see "Test drivers"
+ * in snow.h). Every process started for the same binary also maps the
+ * same claims file, passed in SNOW_CLAIM_FD, so a binary's test cases
+ * are shared between however many processes are running it. When a job
+ * slot frees up, it goes to a binary with test cases left to claim,
+ * so a binary with many slow test cases doesn't hold up the run.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define COLOR_BOLD "\033[1m"
+#define COLOR_RESET "\033[0m"
+#define COLOR_SUCCESS "\033[32m"
+#define COLOR_FAIL "\033[31m"
+
+// The same layout as struct _snow_claims in snow.h
+struct claims {
+	unsigned long next;
+	unsigned long total;
+};
+
+struct binary {
+	char *path;
+	struct claims *claims;
+	int claim_fd;
+	int started;
+	int running;
+	int broken;
+	int num_tests;
+	int num_success;
+};
+
+struct worker {
+	pid_t pid;
+	struct binary *bin;
+	int fd;
+	FILE *out;
+	char buf[2048];
+	size_t len;
+	char current[1024];
+	int records;
+	int ended;
+	int exit_code;
+	int failed;
+};
+
+static struct {
+	int jobs;
+	int quiet;
+	int color;
+	const char *pattern;
+	char **args;
+	int num_args;
+} opts;
+
+static struct binary *bins;
+static size_t num_bins;
+static size_t cap_bins;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void print_msec(double msec) {
+	if (msec < 1)
+		printf("(%.02fµs)", msec * 1000);
+	else if (msec < 1000)
+		printf("(%.02fms)", msec);
+	else
+		printf("(%.02fs)", msec / 1000);
+}
+
+static void usage(const char *argv0) {
+	printf("Usage: %s [options] [path...] [-- test args...]\n", argv0);
+	printf("\n");
+	printf("Runs Snow test binaries in parallel. Each path is either a test binary,\n");
+	printf("or a directory which is searched for test binaries. The arguments after\n");
+	printf("'--' are passed to every test binary.\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("    -j, --jobs <n>        How many test processes to run at once.\n");
+	printf("                          (default: the number of CPUs)\n");
+	printf("    -p, --pattern <glob>  Which files in directories are test binaries.\n");
+	printf("                          (default: test-*)\n");
+	printf("    -q, --quiet           Only print failures and the summary.\n");
+	printf("    -h, --help            Print this help text and exit.\n");
+}
+
+static void add_binary(const char *path) {
+	if (num_bins == cap_bins) {
+		cap_bins = cap_bins == 0 ? 16 : cap_bins * 2;
+		bins = realloc(bins, cap_bins * sizeof(*bins));
+		if (bins == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	struct binary *bin = &bins[num_bins++];
+	memset(bin, 0, sizeof(*bin));
+	bin->path = strdup(path);
+}
+
+/*
+ * Find every executable file in 'dir' and its subdirectories
+ * whose name matches the pattern.
+ */
+static void find_binaries(const char *dir) {
+	DIR *d = opendir(dir);
+	if (d == NULL) {
+		perror(dir);
+		exit(EXIT_FAILURE);
+	}
+
+	struct dirent *ent;
+	while ((ent = readdir(d)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+		struct stat st;
+		if (stat(path, &st) < 0)
+			continue;
+
+		if (S_ISDIR(st.st_mode))
+			find_binaries(path);
+		else if (
+				S_ISREG(st.st_mode) && access(path, X_OK) == 0 &&
+				fnmatch(opts.pattern, ent->d_name, 0) == 0)
+			add_binary(path);
+	}
+
+	closedir(d);
+}
+
+static int compare_binaries(const void *a, const void *b) {
+	return strcmp(
+		((const struct binary *)a)->path, ((const struct binary *)b)->path);
+}
+
+/*
+ * The claims file is shared by every process running the binary.
+ */
+static int create_claims(struct binary *bin) {
+	const char *tmpdir = getenv("TMPDIR");
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/snow-run.XXXXXX", tmpdir ? tmpdir : "/tmp");
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+
+	unlink(path);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if (ftruncate(fd, sizeof(struct claims)) < 0) {
+		perror("ftruncate");
+		close(fd);
+		return -1;
+	}
+
+	bin->claims = mmap(
+		NULL, sizeof(struct claims), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (bin->claims == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Whether another process for 'bin' might find test cases to run.
+ * Once one process has gone through all of the binary's test cases,
+ * 'total' is one more than the number of test cases.
+ */
+static int has_work(struct binary *bin) {
+	if (bin->broken)
+		return 0;
+	if (!bin->started)
+		return 1;
+
+	unsigned long total = __atomic_load_n(&bin->claims->total, __ATOMIC_RELAXED);
+	unsigned long next = __atomic_load_n(&bin->claims->next, __ATOMIC_RELAXED);
+	return total == 0 || next < total - 1;
+}
+
+/*
+ * Binaries which haven't started yet go first, in order.
+ * After that, the binary with the fewest running processes.
+ */
+static struct binary *pick_binary(void) {
+	struct binary *best = NULL;
+	for (size_t i = 0; i < num_bins; ++i) {
+		struct binary *bin = &bins[i];
+		if (!has_work(bin))
+			continue;
+		if (!bin->started)
+			return bin;
+		if (best == NULL || bin->running < best->running)
+			best = bin;
+	}
+
+	return best;
+}
+
+static int start_worker(struct worker *w, struct binary *bin) {
+	if (!bin->started) {
+		bin->claim_fd = create_claims(bin);
+		if (bin->claim_fd < 0)
+			return -1;
+	}
+
+	int fds[2];
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		return -1;
+	}
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	FILE *out = tmpfile();
+	if (out == NULL) {
+		perror("tmpfile");
+		return -1;
+	}
+	fcntl(fileno(out), F_SETFD, FD_CLOEXEC);
+
+	fflush(NULL);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	}
+
+	// Child
+	if (pid == 0) {
+		char fdstr[32];
+		int result_fd = dup(fds[1]);
+		snprintf(fdstr, sizeof(fdstr), "%i", result_fd);
+		setenv("SNOW_RESULT_FD", fdstr, 1);
+		int claim_fd = dup(bin->claim_fd);
+		snprintf(fdstr, sizeof(fdstr), "%i", claim_fd);
+		setenv("SNOW_CLAIM_FD", fdstr, 1);
+
+		dup2(fileno(out), STDOUT_FILENO);
+		dup2(fileno(out), STDERR_FILENO);
+
+		char **argv = malloc((opts.num_args + 2) * sizeof(*argv));
+		argv[0] = bin->path;
+		for (int i = 0; i < opts.num_args; ++i)
+			argv[i + 1] = opts.args[i];
+		argv[opts.num_args + 1] = NULL;
+		execv(bin->path, argv);
+		perror(bin->path);
+		_exit(EXIT_FAILURE);
+	}
+
+	// Parent
+	close(fds[1]);
+	memset(w, 0, sizeof(*w));
+	w->pid = pid;
+	w->bin = bin;
+	w->fd = fds[0];
+	w->out = out;
+	bin->started = 1;
+	bin->running += 1;
+	return 0;
+}
+
+static void print_result(struct worker *w, int success, const char *what, const char *names, double msec) {
+	if (success && opts.quiet)
+		return;
+
+	if (opts.color) {
+		printf(COLOR_BOLD "%s " COLOR_RESET "%s%s" COLOR_RESET "%s: %s",
+			success ? COLOR_SUCCESS "✓" : COLOR_FAIL "✕",
+			success ? COLOR_SUCCESS : COLOR_FAIL, what, w->bin->path, names);
+	} else {
+		printf("%s %s%s: %s", success ? "✓" : "✕", what, w->bin->path, names);
+	}
+
+	if (msec >= 0) {
+		printf(" ");
+		print_msec(msec);
+	}
+	printf("\n");
+}
+
+/*
+ * Turn the tab-separated desc and test case names into "desc: case".
+ */
+static void format_names(char *dest, size_t size, const char *names) {
+	size_t len = 0;
+	for (const char *c = names; *c != '\0' && len + 3 < size; ++c) {
+		if (*c == '\t') {
+			dest[len++] = ':';
+			dest[len++] = ' ';
+		} else {
+			dest[len++] = *c;
+		}
+	}
+	dest[len] = '\0';
+}
+
+static void handle_record(struct worker *w, char *line) {
+	char names[1024];
+	w->records += 1;
+
+	if (strncmp(line, "begin\t", 6) == 0) {
+		snprintf(w->current, sizeof(w->current), "%s", line + 6);
+	} else if (strncmp(line, "case\t", 5) == 0) {
+		char *result = line + 5;
+		char *msec = strchr(result, '\t');
+		char *rest = msec ? strchr(msec + 1, '\t') : NULL;
+		if (rest == NULL)
+			return;
+		*msec++ = '\0';
+		*rest++ = '\0';
+
+		format_names(names, sizeof(names), rest);
+		int success = strcmp(result, "fail") != 0;
+		w->bin->num_tests += 1;
+		w->bin->num_success += success;
+		w->failed |= !success;
+		w->current[0] = '\0';
+		if (strcmp(result, "cached") == 0)
+			print_result(w, 1, "Cached:  ", names, -1);
+		else if (success)
+			print_result(w, 1, "Success: ", names, atof(msec));
+		else
+			print_result(w, 0, "Failed:  ", names, -1);
+	} else if (strncmp(line, "end\t", 4) == 0) {
+		w->ended = 1;
+		w->exit_code = atoi(line + 4);
+	}
+}
+
+/*
+ * Returns 0 once the process has closed its end of the pipe.
+ */
+static int read_records(struct worker *w) {
+	ssize_t n;
+	do {
+		n = read(w->fd, w->buf + w->len, sizeof(w->buf) - w->len - 1);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0)
+		return 0;
+	w->len += n;
+	w->buf[w->len] = '\0';
+
+	char *start = w->buf;
+	char *end;
+	while ((end = strchr(start, '\n')) != NULL) {
+		*end = '\0';
+		handle_record(w, start);
+		start = end + 1;
+	}
+
+	// Lines longer than the buffer are dropped
+	w->len -= start - w->buf;
+	if (w->len == sizeof(w->buf) - 1)
+		w->len = 0;
+	memmove(w->buf, start, w->len);
+	return 1;
+}
+
+/*
+ * Called once a process has exited and its pipe is closed.
+ * Its output is only printed if something failed.
+ */
+static void finish_worker(struct worker *w) {
+	int status;
+	while (waitpid(w->pid, &status, 0) < 0 && errno == EINTR);
+	close(w->fd);
+	w->bin->running -= 1;
+
+	char names[1024];
+	if (!w->ended && w->current[0] != '\0') {
+		// It crashed in the middle of a test case
+		format_names(names, sizeof(names), w->current);
+		w->bin->num_tests += 1;
+		w->failed = 1;
+		print_result(w, 0, "Failed:  ", names, -1);
+	} else if (!w->ended) {
+		// It died outside of a test case, so the next process would too
+		w->bin->broken = 1;
+		w->failed = 1;
+		printf("%s %s: %s\n",
+			opts.color ? COLOR_BOLD COLOR_FAIL "✕" COLOR_RESET : "✕",
+			w->bin->path, w->records == 0 ?
+				"Not a Snow test binary, or it failed to start." :
+				"Died outside of a test case.");
+	} else if (w->exit_code != EXIT_SUCCESS && !w->failed) {
+		w->failed = 1;
+		printf("%s %s: Exited with status %i.\n",
+			opts.color ? COLOR_BOLD COLOR_FAIL "✕" COLOR_RESET : "✕",
+			w->bin->path, w->exit_code);
+	}
+
+	if (w->failed) {
+		printf("\nOutput of %s (pid %i):\n", w->bin->path, (int)w->pid);
+		if (!w->ended) {
+			if (WIFSIGNALED(status))
+				printf("    Killed by signal %i.\n", WTERMSIG(status));
+			else
+				printf("    Exited with status %i.\n", WEXITSTATUS(status));
+		}
+		fflush(stdout);
+		rewind(w->out);
+		char buf[4096];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), w->out)) > 0)
+			fwrite(buf, 1, n, stdout);
+		printf("\n");
+	}
+
+	fclose(w->out);
+	w->pid = 0;
+}
+
+static int parse_args(int argc, char **argv) {
+	opts.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	opts.pattern = "test-*";
+
+	for (int i = 1; i < argc; ++i) {
+		char *arg = argv[i];
+		if (strcmp(arg, "--") == 0) {
+			opts.args = argv + i + 1;
+			opts.num_args = argc - i - 1;
+			break;
+		} else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		} else if (strcmp(arg, "-q") == 0 || strcmp(arg, "--quiet") == 0) {
+			opts.quiet = 1;
+		} else if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0) {
+			if (++i >= argc) {
+				fprintf(stderr, "%s: Argument expected.\n", arg);
+				return -1;
+			}
+			opts.jobs = atoi(argv[i]);
+		} else if (strcmp(arg, "-p") == 0 || strcmp(arg, "--pattern") == 0) {
+			if (++i >= argc) {
+				fprintf(stderr, "%s: Argument expected.\n", arg);
+				return -1;
+			}
+			opts.pattern = argv[i];
+		} else if (arg[0] == '-') {
+			fprintf(stderr, "Unknown option: %s\n", arg);
+			return -1;
+		} else {
+			struct stat st;
+			if (stat(arg, &st) < 0) {
+				perror(arg);
+				return -1;
+			}
+			if (S_ISDIR(st.st_mode))
+				find_binaries(arg);
+			else
+				add_binary(arg);
+		}
+	}
+
+	if (opts.jobs < 1)
+		opts.jobs = 1;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (parse_args(argc, argv) < 0)
+		return EXIT_FAILURE;
+
+	if (num_bins == 0)
+		find_binaries(".");
+	if (num_bins == 0) {
+		fprintf(stderr, "No test binaries found.\n");
+		return EXIT_FAILURE;
+	}
+	qsort(bins, num_bins, sizeof(*bins), compare_binaries);
+
+	opts.color = isatty(STDOUT_FILENO) && getenv("NO_COLOR") == NULL;
+
+	struct worker *workers = calloc(opts.jobs, sizeof(*workers));
+	struct pollfd *fds = calloc(opts.jobs, sizeof(*fds));
+	if (workers == NULL || fds == NULL) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	double start_time = now();
+	int exit_code = EXIT_SUCCESS;
+	int running = 0;
+	while (1) {
+		// Fill the free job slots
+		struct binary *bin;
+		for (int i = 0; i < opts.jobs && (bin = pick_binary()) != NULL; ++i) {
+			if (workers[i].pid != 0)
+				continue;
+			if (start_worker(&workers[i], bin) < 0)
+				return EXIT_FAILURE;
+			running += 1;
+		}
+
+		if (running == 0)
+			break;
+
+		for (int i = 0; i < opts.jobs; ++i) {
+			fds[i].fd = workers[i].pid != 0 ? workers[i].fd : -1;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		if (poll(fds, opts.jobs, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return EXIT_FAILURE;
+		}
+
+		for (int i = 0; i < opts.jobs; ++i) {
+			struct worker *w = &workers[i];
+			if (w->pid == 0 || fds[i].revents == 0)
+				continue;
+
+			if (!read_records(w)) {
+				finish_worker(w);
+				running -= 1;
+				if (w->failed)
+					exit_code = EXIT_FAILURE;
+			}
+		}
+	}
+
+	// Summary
+	int total_tests = 0;
+	int total_success = 0;
+	if (!opts.quiet)
+		printf("\n");
+	for (size_t i = 0; i < num_bins; ++i) {
+		struct binary *bin = &bins[i];
+		total_tests += bin->num_tests;
+		total_success += bin->num_success;
+		if (!opts.quiet)
+			printf("%s: Passed %i/%i tests.\n",
+				bin->path, bin->num_success, bin->num_tests);
+		if (bin->num_success != bin->num_tests)
+			exit_code = EXIT_FAILURE;
+	}
+
+	const char *binaries = num_bins == 1 ? "binary" : "binaries";
+	if (opts.color)
+		printf(COLOR_BOLD "Total: Passed %i/%i tests in %zu %s. " COLOR_RESET,
+			total_success, total_tests, num_bins, binaries);
+	else
+		printf("Total: Passed %i/%i tests in %zu %s. ",
+			total_success, total_tests, num_bins, binaries);
+	print_msec(now() - start_time);
+	printf("\n");
+
+	for (size_t i = 0; i < num_bins; ++i) {
+		if (bins[i].started) {
+			munmap(bins[i].claims, sizeof(struct claims));
+			close(bins[i].claim_fd);
+		}
+		free(bins[i].path);
+	}
+	free(bins);
+	free(workers);
+	free(fds);
+	return exit_code;
+}
@@ -32,14 +32,35 @@
 #define subdesc(...) while (0)
 #define it(...) while (0)
 #define test(...) while (0)
+#define stress(...) while (0)
+#define snow_sweep(...) while (0)
 #define defer(...)
 #define before_each(...) while (0)
 #define after_each(...) while (0)
+#define before_all(...) while (0)
+#define after_all(...) while (0)
 #define snow_fail_update(...)
 #define snow_fail(...)
 #define fail(...)
 #define assert(...)
 #define snow_break()
+#define snow_do_not_optimize(...) ((void)0)
+#define snow_trace_begin(...) ((void)0)
+#define snow_trace_end() ((void)0)
+#define snow_advance_time(...) ((void)0)
+#define snow_clobber_memory() ((void)0)
+#define snow_cache_inputs(...)
+#define snow_fixture(name, setup, teardown) \
+	__attribute__((unused)) static struct { \
+		void *(*s)(void); void (*t)(void *); \
+	} _snow_unused_fixture_##name = { setup, teardown }
+#define snow_use_fixture(...)
+#define snow_use_fixture_in(desc, name) \
+	__attribute__((unused)) static struct { \
+		const char *d; const char *f; \
+	} _snow_unused_fixture_use_##desc##_##name = { #desc, #name }
+#define snow_fixture_get(...) ((void *)0)
+#define snow_tmpdir() ((const char *)0)
 #define snow_rerun_failed()
 
 #define asserteq_dbl(...)
@@ -48,6 +69,12 @@
 #define asserteq_int(...)
 #define asserteq_uint(...)
 #define asserteq_buf(...)
+#define assert_matches_golden(...)
+#define assert_matches_golden_fd(...)
+#define assert_matches_golden_file(...)
+#define assert_complexity(...)
+#define assert_syscalls_le(...)
+#define assert_io_bytes_le(...)
 #define asserteq(...)
 
 #define assertneq_dbl(...)
@@ -63,10 +90,25 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <sys/time.h>
 #include <setjmp.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+
+// Before glibc 2.34, dlopen, dlsym and dladdr are in libdl,
+// which would need -ldl
+#if defined(__GLIBC__) && !defined(__UCLIBC__)
+# if __GLIBC_PREREQ(2, 34)
+#  define _SNOW_LIBC_HAS_DL 1
+# endif
+#endif
+#ifndef _SNOW_LIBC_HAS_DL
+# define _SNOW_LIBC_HAS_DL 0
+#endif
 
 #ifdef __MINGW32__
 # ifndef SNOW_USE_FNMATCH
@@ -75,6 +117,18 @@
 # ifndef SNOW_USE_FORK
 #  define SNOW_USE_FORK 0
 # endif
+# ifndef SNOW_USE_PTHREAD
+#  define SNOW_USE_PTHREAD 0
+# endif
+# ifndef SNOW_USE_MMAP
+#  define SNOW_USE_MMAP 0
+# endif
+# ifndef SNOW_USE_BACKTRACE
+#  define SNOW_USE_BACKTRACE 0
+# endif
+# ifndef SNOW_USE_DLADDR
+#  define SNOW_USE_DLADDR 0
+# endif
 #else
 # ifndef SNOW_USE_FNMATCH
 #  define SNOW_USE_FNMATCH 1
@@ -82,6 +136,22 @@
 # ifndef SNOW_USE_FORK
 #  define SNOW_USE_FORK 1
 # endif
+# ifndef SNOW_USE_PTHREAD
+#  define SNOW_USE_PTHREAD 1
+# endif
+# ifndef SNOW_USE_MMAP
+#  define SNOW_USE_MMAP 1
+# endif
+# ifndef SNOW_USE_BACKTRACE
+#  ifdef __GLIBC__
+#   define SNOW_USE_BACKTRACE 1
+#  else
+#   define SNOW_USE_BACKTRACE 0
+#  endif
+# endif
+# ifndef SNOW_USE_DLADDR
+#  define SNOW_USE_DLADDR _SNOW_LIBC_HAS_DL
+# endif
 #endif
 
 #if SNOW_USE_FNMATCH != 0
@@ -92,6 +162,45 @@
 #include <sys/wait.h>
 #endif
 
+#if SNOW_USE_PTHREAD != 0
+#include <pthread.h>
+#endif
+
+#if SNOW_USE_MMAP != 0
+#include <sys/mman.h>
+#endif
+
+#if SNOW_USE_BACKTRACE != 0
+#include <execinfo.h>
+#endif
+
+#if (SNOW_USE_BACKTRACE != 0 && SNOW_USE_DLADDR != 0) || \
+		(defined(SNOW_VIRTUAL_TIME) && _SNOW_LIBC_HAS_DL != 0)
+#include <dlfcn.h>
+#endif
+
+#if defined(SNOW_VIRTUAL_TIME) && _SNOW_LIBC_HAS_DL != 0
+#include <gnu/lib-names.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/auxv.h>
+#include <sys/inotify.h>
+#include <link.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#endif
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#ifdef _POSIX_TIMERS
+#include <time.h>
+#endif
+
 #define SNOW_VERSION "2.3.2"
 
 // Eventually, I want to re-implement optional explanation arguments
@@ -137,6 +246,67 @@
 #define SNOW_DEFAULT_ARGS
 #endif
 
+// How many bytes of output --async-log can hold before printing blocks
+#ifndef SNOW_LOG_RING_SIZE
+#define SNOW_LOG_RING_SIZE (1024 * 1024)
+#endif
+
+// How often --progress redraws its status line, in milliseconds
+#ifndef SNOW_PROGRESS_INTERVAL
+#define SNOW_PROGRESS_INTERVAL 100
+#endif
+
+// How long each size in a snow_sweep has to run for, in milliseconds
+#ifndef SNOW_SWEEP_MIN_MSEC
+#define SNOW_SWEEP_MIN_MSEC 5
+#endif
+
+// How often --profile samples a running test case, in microseconds
+#ifndef SNOW_PROFILE_USEC
+#define SNOW_PROFILE_USEC 1000
+#endif
+
+// How many samples --profile can take of one test case,
+// and how many stack frames each sample can hold
+#ifndef SNOW_PROFILE_MAX_SAMPLES
+#define SNOW_PROFILE_MAX_SAMPLES 10000
+#endif
+#ifndef SNOW_PROFILE_DEPTH
+#define SNOW_PROFILE_DEPTH 64
+#endif
+
+// How many stack frames SNOW_TRACK_ALLOCS records for each allocation
+#ifndef SNOW_ALLOC_DEPTH
+#define SNOW_ALLOC_DEPTH 16
+#endif
+
+/*
+ * Allocation
+ */
+
+/*
+ * Snow allocates its own memory through these, so that with
+ * SNOW_TRACK_ALLOCS, the allocation tracker only sees the test's memory.
+ */
+#ifdef SNOW_TRACK_ALLOCS
+# ifndef __GLIBC__
+#  error "SNOW_TRACK_ALLOCS requires glibc"
+# endif
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t num, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+# define _snow_malloc __libc_malloc
+# define _snow_calloc __libc_calloc
+# define _snow_realloc __libc_realloc
+# define _snow_free __libc_free
+#else
+# define _snow_malloc malloc
+# define _snow_calloc calloc
+# define _snow_realloc realloc
+# define _snow_free free
+#endif
+
 /*
  * Array
  */
@@ -162,7 +332,7 @@ static void _snow_arr_grow(struct _snow_arr *arr, size_t size) {
 		return;
 
 	arr->allocated = size;
-	arr->elems = realloc(arr->elems, arr->allocated * arr->elem_size);
+	arr->elems = _snow_realloc(arr->elems, arr->allocated * arr->elem_size);
 }
 
 __attribute__((unused))
@@ -174,10 +344,10 @@ __attribute__((unused))
 static void _snow_arr_push(struct _snow_arr *arr, void *elem) {
 	if (arr->allocated == 0) {
 		arr->allocated = 8;
-		arr->elems = malloc(arr->allocated * arr->elem_size);
+		arr->elems = _snow_malloc(arr->allocated * arr->elem_size);
 	} else if (arr->allocated <= arr->length) {
 		arr->allocated *= 2;
-		arr->elems = realloc(arr->elems, arr->allocated * arr->elem_size);
+		arr->elems = _snow_realloc(arr->elems, arr->allocated * arr->elem_size);
 	}
 	memcpy(
 		arr->elems + arr->length * arr->elem_size, elem, arr->elem_size);
@@ -198,7 +368,7 @@ static void *_snow_arr_top(struct _snow_arr *arr) {
 
 __attribute__((unused))
 static void _snow_arr_reset(struct _snow_arr *arr) {
-	free(arr->elems);
+	_snow_free(arr->elems);
 	arr->elems = NULL;
 	arr->length = 0;
 	arr->allocated = 0;
@@ -223,6 +393,27 @@ enum {
 	_SNOW_OPT_LOG,
 	_SNOW_OPT_RERUN_FAILED,
 	_SNOW_OPT_GDB,
+	_SNOW_OPT_ASSERT_STATS,
+	_SNOW_OPT_UPDATE_GOLDEN,
+	_SNOW_OPT_CACHE,
+	_SNOW_OPT_WATCH,
+	_SNOW_OPT_WATCH_FILE,
+	_SNOW_OPT_FORK_CASES,
+	_SNOW_OPT_SLOWEST,
+	_SNOW_OPT_MAX_CASE_TIME,
+	_SNOW_OPT_BUDGET_WARN,
+	_SNOW_OPT_BENCH_ENV,
+	_SNOW_OPT_BENCH_CPU,
+	_SNOW_OPT_PROGRESS,
+	_SNOW_OPT_TEE,
+	_SNOW_OPT_ASYNC_LOG,
+	_SNOW_OPT_TRACE,
+	_SNOW_OPT_PROFILE,
+	_SNOW_OPT_FORMAT,
+	_SNOW_OPT_RUN_ID,
+	_SNOW_OPT_IO_STATS,
+	_SNOW_OPT_TMP_DIR,
+	_SNOW_OPT_KEEP_TMP,
 	_SNOW_OPT_LAST,
 };
 
@@ -230,10 +421,12 @@ struct _snow_opt {
 	char *name;
 	char shortname;
 	int is_bool;
+	int is_list;
 	union {
 		int boolval;
 		char *strval;
 	};
+	struct _snow_arr listval;
 	int is_overwritten;
 };
 
@@ -250,6 +443,15 @@ struct _snow_desc {
 	int has_before_jmp;
 	jmp_buf after_jmp;
 	int has_after_jmp;
+	jmp_buf before_all_jmp;
+	int has_before_all_jmp;
+	int before_all_failed;
+	int cases_ran;
+	uint64_t cache_inputs;
+	struct _snow_arr fixtures;
+	struct _snow_arr case_names;
+	size_t time_node;
+	double children_msec;
 };
 
 struct _snow_desc_func {
@@ -257,12 +459,162 @@ struct _snow_desc_func {
 	void (*func)(void);
 };
 
-struct _snow {
-	int exit_code;
+/*
+ * The options of a test case, as in it("name", .budget_ms = 5).
+ */
+struct _snow_case_opts {
+	const char *name;
+	double budget_ms;
+	int budget_warn;
+	const char *tags;
+};
+
+struct _snow_case_time {
+	char *name;
+	double msec;
+	size_t index;
+};
+
+struct _snow_desc_time {
+	const char *name;
+	int depth;
+	int num_tests;
+	double self_msec;
+	double total_msec;
+};
+
+struct _snow_sweep_point {
+	size_t n;
+	double msec;
+};
+
+struct _snow_profile_sample {
+	int depth;
+	void *pcs[SNOW_PROFILE_DEPTH];
+};
+
+struct _snow_profile_stack {
+	int depth;
+	unsigned long count;
+	void *pcs[SNOW_PROFILE_DEPTH];
+};
+
+struct _snow_profile_case {
+	char *name;
+	size_t first_stack;
+	size_t num_stacks;
+	unsigned long samples;
+	size_t index;
+};
+
+struct _snow_profile_func {
+	char name[256];
+	unsigned long count;
+};
+
+struct _snow_alloc {
+	void *ptr;
+	size_t size;
+	unsigned long seq;
+	int depth;
+	void *pcs[SNOW_ALLOC_DEPTH];
+};
+
+struct _snow_profile_line {
+	char *text;
+	unsigned long count;
+};
+
+struct _snow_sym {
+	uintptr_t start;
+	uintptr_t end;
+	const char *name;
+};
+
+/*
+ * Shared between every process snow-run starts for the same binary.
+ * snow-run has its own copy of this layout.
+ */
+struct _snow_claims {
+	unsigned long next;
+	unsigned long total;
+};
+
+// The same layout as Dl_info, which needs _GNU_SOURCE
+struct _snow_dl_info {
+	const char *dli_fname;
+	void *dli_fbase;
+	const char *dli_sname;
+	void *dli_saddr;
+};
+
+enum _snow_complexity {
+	_SNOW_O_1,
+	_SNOW_O_LOG_N,
+	_SNOW_O_N,
+	_SNOW_O_N_LOG_N,
+	_SNOW_O_N2,
+	_SNOW_O_LAST,
+};
+
+// Counters from /proc/self/io, for --io-stats
+struct _snow_io_stats {
+	unsigned long long reads;
+	unsigned long long writes;
+	unsigned long long read_bytes;
+	unsigned long long written_bytes;
+};
+
+struct _snow_fixture {
+	const char *name;
+	void *(*setup)(void);
+	void (*teardown)(void *);
+	void *value;
+	int constructed;
+	size_t last_desc;
+};
+
+/*
+ * A snow_use_fixture_in, saying that the describe 'desc' uses 'fixture'.
+ */
+struct _snow_fixture_use {
+	const char *desc;
+	const char *fixture;
+};
+
+/*
+ * State which belongs to each thread rather than to the whole test suite.
+ * The thread which runs the test cases has 'is_case_thread' set,
+ * any other thread is a worker thread started by the test itself.
+ */
+struct _snow_thread {
 	const char *filename;
 	int linenum;
+	int is_case_thread;
+	int untracked;
+	jmp_buf *bail_jmp;
+};
+
+/*
+ * The fatal signals which --async-log writes the rest of the ring buffer on.
+ */
+#define _SNOW_LOG_SIGNALS SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGTERM, SIGINT
+#define _SNOW_LOG_NUM_SIGNALS 7
+
+struct _snow {
+	int exit_code;
+	unsigned long num_asserts;
+	int num_cached;
+	int num_listed;
+	int run_id_found;
+	uint64_t cache_binary_id;
+	int watch_fd;
+	volatile sig_atomic_t watch_stopped;
+	double max_case_time;
 
 	struct _snow_arr desc_funcs;
+	struct _snow_arr fixtures;
+	struct _snow_arr fixture_uses;
 	struct _snow_arr desc_stack;
 	struct _snow_arr desc_patterns;
 	struct _snow_desc *current_desc;
@@ -271,11 +623,59 @@ struct _snow {
 	int in_case;
 	int in_before_each;
 	int in_after_each;
+	int in_before_all;
+	int in_after_all;
 	int rerunning_case;
 	struct {
 		int success;
 		const char *name;
+		struct _snow_case_opts opts;
+		const char *filename;
+		int linenum;
+		double over_budget;
+		int check_budget;
+		int pass_deferred;
+		struct _snow_io_stats io;
+		char tmpdir[PATH_MAX];
+		int start_cpu;
+		int cpu;
+		int migrations;
+		long start_migrations;
 		double start_time;
+		struct _snow_desc *before_all;
+		int before_all_failed;
+		unsigned long num_asserts;
+		unsigned long thread_asserts;
+		uint64_t cache_key;
+		struct {
+			int threads;
+			unsigned long ops;
+			double msec;
+			double fairness;
+			double spread;
+		} stress;
+		struct {
+			struct _snow_arr points;
+			size_t n;
+			size_t hi;
+			unsigned long reps;
+			unsigned long rep;
+			int round;
+			double best;
+			double start_time;
+		} sweep;
+		struct {
+			int failed;
+			const char *filename;
+			int linenum;
+			unsigned long thread_id;
+			char msg[512];
+		} thread_fail;
+		struct {
+			int errors;
+			int ready;
+			char msg[512];
+		} sanitizer;
 		struct _snow_arr defers;
 		jmp_buf rerun;
 		jmp_buf done_jmp_ret;
@@ -284,19 +684,126 @@ struct _snow {
 		jmp_buf after_jmp_ret;
 	} current_case;
 
+	struct {
+		int is_child;
+		int result_fd;
+	} fork;
+
+	struct {
+		int pinned;
+		unsigned long mask[1024 / (8 * sizeof(unsigned long))];
+	} bench;
+
+	struct {
+		struct _snow_arr cases;
+		struct _snow_arr descs;
+	} times;
+
+	struct {
+		FILE *file;
+		int depth;
+		int case_depth;
+	} trace;
+
+	struct {
+		int result_fd;
+		struct _snow_claims *claims;
+		unsigned long index;
+		unsigned long claimed;
+		int need_claim;
+	} run;
+
+	struct {
+		int active;
+		char lock;
+		struct _snow_alloc *table;
+		size_t capacity;
+		size_t count;
+		unsigned long seq;
+		uintptr_t loader_start;
+		uintptr_t loader_end;
+		void *base[SNOW_ALLOC_DEPTH];
+		int base_depth;
+	} allocs;
+
+	struct {
+		int active;
+		int64_t offset;
+		int64_t realtime;
+		int64_t monotonic;
+		int (*clock_gettime)(clockid_t, struct timespec *);
+	} vtime;
+
+	struct {
+		int fd;
+		pid_t pid;
+		struct _snow_io_stats start;
+		struct _snow_io_stats overhead;
+	} io;
+
+	struct {
+		int loaded;
+		int (*dladdr)(const void *, struct _snow_dl_info *);
+		char *exe;
+		struct _snow_arr syms;
+	} symbols;
+
+	struct {
+		int enabled;
+		struct _snow_profile_sample *samples;
+		size_t num_samples;
+		unsigned long dropped;
+		void *base[SNOW_PROFILE_DEPTH];
+		int base_depth;
+		struct _snow_arr cases;
+		struct _snow_arr stacks;
+#if SNOW_USE_BACKTRACE != 0
+		struct sigaction old_action;
+#endif
+	} profile;
+
+	struct {
+		int is_tty;
+		int drawn;
+		int descs;
+		int descs_done;
+		int done;
+		int failed;
+		double start_time;
+		double draw_time;
+	} progress;
+
 	struct {
 		FILE *file;
-		int file_opened;
+		struct _snow_arr files;
+		struct _snow_arr fds;
 		int need_cr;
 		enum {
 			_SNOW_PRINT_CASE,
 			_SNOW_PRINT_DESC_BEGIN,
 			_SNOW_PRINT_DESC_END,
 		} prev_print;
+		struct {
+			int enabled;
+			int done;
+			char *buf;
+			size_t head;
+			size_t tail;
+			size_t claimed;
+#if SNOW_USE_PTHREAD != 0
+			pthread_t thread;
+			pthread_mutex_t mutex;
+			pthread_cond_t cond;
+			struct sigaction old_actions[_SNOW_LOG_NUM_SIGNALS];
+			int handled[_SNOW_LOG_NUM_SIGNALS];
+#endif
+		} async;
 	} print;
 
 	struct {
 		struct _snow_arr spaces;
+		struct _snow_arr id;
+		struct _snow_arr list;
 	} bufs;
 };
 
@@ -306,6 +813,7 @@ struct _snow {
 
 extern struct _snow _snow;
 extern int _snow_inited;
+extern __thread struct _snow_thread _snow_thread;
 
 /*
  * Opts
@@ -321,6 +829,9 @@ extern int _snow_inited;
 	_snow.opts[id].name = n; _snow.opts[id].shortname = sn; \
 	_snow.opts[id].is_bool = 0; _snow.opts[id].strval = val; \
 	_snow.opts[id].is_overwritten = 0
+#define _snow_opt_list(id, n, sn) \
+	_snow_opt_str(id, n, sn, NULL); _snow.opts[id].is_list = 1; \
+	_snow_arr_init(&_snow.opts[id].listval, sizeof(char *))
 
 /*
  * Util
@@ -339,15 +850,51 @@ static char *_snow_spaces(int depth) {
 	return _snow.bufs.spaces.elems;
 }
 
+/*
+ * With SNOW_VIRTUAL_TIME, tests get clock and sleep functions which
+ * can be fast-forwarded, so snow gets the real time from the C library's
+ * clock_gettime, which _snow_vtime_init looks up. Until then, or if it
+ * can't be found, it asks the kernel, which is slower than the vDSO.
+ */
+#ifdef SNOW_VIRTUAL_TIME
+# ifndef __linux__
+#  error "SNOW_VIRTUAL_TIME requires Linux"
+# endif
+__attribute__((unused))
+static int _snow_clock_gettime(clockid_t clock, struct timespec *ts) {
+	if (_snow.vtime.clock_gettime != NULL)
+		return _snow.vtime.clock_gettime(clock, ts);
+	return syscall(SYS_clock_gettime, clock, ts);
+}
+#else
+# define _snow_clock_gettime clock_gettime
+#endif
+
+/*
+ * The real clock, in milliseconds. Unlike _snow_now, this is always
+ * the actual time, even with --no-timer, SNOW_DUMMY_TIMER or
+ * SNOW_VIRTUAL_TIME, and it's safe to call from any thread.
+ */
+__attribute__((unused))
+static double _snow_clock(void) {
+#if defined(_POSIX_TIMERS) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	_snow_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+#endif
+}
+
 #ifndef SNOW_DUMMY_TIMER
 __attribute__((unused))
 static double _snow_now(void) {
 	if (!_snow.opts[_SNOW_OPT_TIMER].boolval)
 		return 0;
 
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+	return _snow_clock();
 }
 #else
 __attribute__((unused))
@@ -359,179 +906,3807 @@ static double _snow_now(void) {
 #endif
 
 /*
- * Printing
+ * log2 and sqrt, so that we don't need libm.
  */
-
-#define _snow_print(...) fprintf(_snow.print.file, __VA_ARGS__)
-
 __attribute__((unused))
-static void _snow_print_timer(double start_time) {
-	double msec = _snow_now() - start_time;
-	if (msec < 0) msec = 0;
-	if (msec < 1) {
-		_snow_print("(%.02fµs)", msec * 1000);
-	} else if (msec < 1000) {
-		_snow_print("(%.02fms)", msec);
-	} else {
-		_snow_print("(%.02fs)", msec / 1000);
+static double _snow_log2(double x) {
+	if (x <= 0)
+		return 0;
+
+	double res = 0;
+	while (x >= 2) { x /= 2; res += 1; }
+	while (x < 1) { x *= 2; res -= 1; }
+
+	// Each squaring of the mantissa gives us one more bit of the result
+	double bit = 0.5;
+	for (int i = 0; i < 32; ++i, bit /= 2) {
+		x *= x;
+		if (x >= 2) {
+			x /= 2;
+			res += bit;
+		}
 	}
+
+	return res;
 }
 
 __attribute__((unused))
-static void _snow_print_case_begin(void) {
-	if (_snow.opts[_SNOW_OPT_QUIET].boolval) return;
-	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
+static double _snow_sqrt(double x) {
+	if (x <= 0)
+		return 0;
 
-	_snow.print.prev_print = _SNOW_PRINT_CASE;
+	double res = x > 1 ? x : 1;
+	for (int i = 0; i < 1024; ++i) {
+		double next = (res + x / res) / 2;
+		if (next >= res)
+			break;
+		res = next;
+	}
 
-	if (!_snow.opts[_SNOW_OPT_MAYBES].boolval)
-		return;
+	return res;
+}
 
-	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
-		_snow_print(
-			"%s" SNOW_COLOR_BOLD SNOW_COLOR_MAYBE "? "
-			SNOW_COLOR_RESET SNOW_COLOR_MAYBE "Testing: "
-			SNOW_COLOR_RESET SNOW_COLOR_DESC "%s: " SNOW_COLOR_RESET,
-			spaces, _snow.current_case.name);
-	} else {
-		_snow_print(
-			"%s? Testing: %s: ", spaces, _snow.current_case.name);
-	}
+__attribute__((unused))
+static const char *_snow_complexity_names[] = {
+	"O(1)", "O(log n)", "O(n)", "O(n log n)", "O(n^2)",
+};
 
-	if (_snow.opts[_SNOW_OPT_CR].boolval) {
-		_snow.print.need_cr = 1;
-		fflush(_snow.print.file);
-	} else {
-		_snow_print("\n");
+__attribute__((unused))
+static double _snow_complexity_f(enum _snow_complexity complexity, double n) {
+	switch (complexity) {
+	case _SNOW_O_1: return 1;
+	case _SNOW_O_LOG_N: return _snow_log2(n);
+	case _SNOW_O_N: return n;
+	case _SNOW_O_N_LOG_N: return n * _snow_log2(n);
+	case _SNOW_O_N2: return n * n;
+	default: return 0;
 	}
 }
 
+/*
+ * Fit a line to log(time / f(n)) against log(n) for the current sweep with
+ * least squares, and return its slope. The slope is about 0 when the time
+ * grows like f, and otherwise says how much faster it grows: fitting O(n^2)
+ * times to O(n) gives 1. If 'error' isn't NULL, it's set to the RMS
+ * distance of the points from the line, which is roughly relative to
+ * the time.
+ */
 __attribute__((unused))
-static void _snow_print_case_success(void) {
-	if (_snow.opts[_SNOW_OPT_QUIET].boolval) return;
-	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
-
-	if (_snow.print.need_cr)
-		_snow_print(" \r");
+static double _snow_sweep_slope(
+		enum _snow_complexity complexity, double *error) {
+	struct _snow_arr *points = &_snow.current_case.sweep.points;
+	size_t count = points->length;
+	if (count == 0) {
+		if (error != NULL)
+			*error = 0;
+		return 0;
+	}
 
-	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
-		_snow_print(
-			"%s" SNOW_COLOR_BOLD SNOW_COLOR_SUCCESS "✓ "
-			SNOW_COLOR_RESET SNOW_COLOR_SUCCESS "Success: "
-			SNOW_COLOR_RESET SNOW_COLOR_DESC "%s"
-			SNOW_COLOR_RESET,
-			spaces, _snow.current_case.name);
-	} else {
-		_snow_print(
-			"%s✓ Success: %s", spaces, _snow.current_case.name);
+	double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+	for (size_t i = 0; i < count; ++i) {
+		struct _snow_sweep_point *p = _snow_arr_get(points, i);
+		double f = _snow_complexity_f(complexity, p->n);
+		double x = _snow_log2(p->n);
+		double y = _snow_log2(p->msec) - _snow_log2(f < 1 ? 1 : f);
+		sum_x += x;
+		sum_y += y;
+		sum_xx += x * x;
+		sum_xy += x * y;
 	}
 
-	if (_snow.opts[_SNOW_OPT_TIMER].boolval) {
-		_snow_print(" ");
-		_snow_print_timer(_snow.current_case.start_time);
+	double denom = count * sum_xx - sum_x * sum_x;
+	double slope = denom > 0 ? (count * sum_xy - sum_x * sum_y) / denom : 0;
+	if (error == NULL)
+		return slope;
+
+	double sum_sq = 0;
+	for (size_t i = 0; i < count; ++i) {
+		struct _snow_sweep_point *p = _snow_arr_get(points, i);
+		double f = _snow_complexity_f(complexity, p->n);
+		double x = _snow_log2(p->n);
+		double y = _snow_log2(p->msec) - _snow_log2(f < 1 ? 1 : f);
+		double err = y - (sum_y + slope * (count * x - sum_x)) / count;
+		sum_sq += err * err;
 	}
 
-	_snow_print("\n");
+	// A difference of d in log2 is a factor of 2^d, or about 1 + d ln 2
+	*error = _snow_sqrt(sum_sq / count) * 0.693147;
+	return slope;
 }
 
+/*
+ * Find the complexity which fits the current sweep best, which is the one
+ * with the slope closest to 0. The times have to grow at least halfway
+ * (in log-log terms) to the next complexity before they're taken to be
+ * that one, which leaves plenty of room for noise.
+ */
 __attribute__((unused))
-static char *_snow_print_case_failure(void) {
-	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
-
-	if (_snow.print.need_cr)
-		_snow_print(" \r");
-
-	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
-		_snow_print(
-			"%s" SNOW_COLOR_BOLD SNOW_COLOR_FAIL "✕ "
-			SNOW_COLOR_RESET SNOW_COLOR_FAIL "Failed:  "
-			SNOW_COLOR_RESET SNOW_COLOR_DESC "%s"
-			SNOW_COLOR_RESET ":\n",
-			spaces, _snow.current_case.name);
-	} else {
-		_snow_print(
-			"%s✕ Failed:  %s:\n", spaces, _snow.current_case.name);
+static enum _snow_complexity _snow_sweep_fit(double *error) {
+	enum _snow_complexity best = _SNOW_O_1;
+	double best_slope = 0;
+	for (int i = 0; i < _SNOW_O_LAST; ++i) {
+		double slope = _snow_sweep_slope(i, NULL);
+		if (slope < 0)
+			slope = -slope;
+		if (i == 0 || slope < best_slope) {
+			best = i;
+			best_slope = slope;
+		}
 	}
 
-	return spaces;
+	_snow_sweep_slope(best, error);
+	return best;
 }
 
 __attribute__((unused))
-static void _snow_print_desc_begin_index(size_t index) {
-	if (index > 0) {
-		struct _snow_desc *parent = _snow_arr_get(&_snow.desc_stack, index - 1);
-		if (!parent->printed)
-			_snow_print_desc_begin_index(index - 1);
-	}
-
-	_snow_print("\n");
-	_snow.print.prev_print = _SNOW_PRINT_DESC_BEGIN;
+static unsigned long _snow_thread_id(void) {
+#if defined(__linux__) && defined(SYS_gettid)
+	return (unsigned long)syscall(SYS_gettid);
+#elif SNOW_USE_PTHREAD != 0
+	return (unsigned long)pthread_self();
+#else
+	return 0;
+#endif
+}
 
-	struct _snow_desc *desc = _snow_arr_get(&_snow.desc_stack, index);
-	char *spaces = _snow_spaces(index);
+/*
+ * Log output
+ */
 
-	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
-		_snow_print(
+/*
+ * Write everything in the ring buffer between 'from' and 'to' to the
+ * log files. Only uses write(), so that it can be used from signal handlers.
+ */
+__attribute__((unused))
+static void _snow_log_write_raw(size_t from, size_t to) {
+	while (from < to) {
+		size_t start = from % SNOW_LOG_RING_SIZE;
+		size_t len = to - from;
+		if (len > SNOW_LOG_RING_SIZE - start)
+			len = SNOW_LOG_RING_SIZE - start;
+
+		for (size_t i = 0; i < _snow.print.fds.length; ++i) {
+			int fd = *(int *)_snow_arr_get(&_snow.print.fds, i);
+			const char *data = _snow.print.async.buf + start;
+			size_t left = len;
+			while (left > 0) {
+				ssize_t n = write(fd, data, left);
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n <= 0)
+					break;
+				data += n;
+				left -= n;
+			}
+		}
+
+		from += len;
+	}
+}
+
+#if SNOW_USE_PTHREAD != 0
+/*
+ * Called on fatal signals with --async-log. A handler which was installed
+ * before ours gets the signal first, and if it returns, so do we. Otherwise,
+ * the writer thread might be in the middle of writing everything up to
+ * 'claimed', so we take over whatever comes after that, write it, and then
+ * die from the signal with the old action.
+ */
+__attribute__((unused))
+static void _snow_log_crash(int sig, siginfo_t *info, void *ctx) {
+	static const int sigs[_SNOW_LOG_NUM_SIGNALS] = { _SNOW_LOG_SIGNALS };
+	size_t i = 0;
+	while (i < _SNOW_LOG_NUM_SIGNALS - 1 && sigs[i] != sig)
+		i += 1;
+
+	struct sigaction *old = &_snow.print.async.old_actions[i];
+	if (old->sa_flags & SA_SIGINFO) {
+		old->sa_sigaction(sig, info, ctx);
+		return;
+	} else if (old->sa_handler != SIG_DFL && old->sa_handler != SIG_IGN) {
+		old->sa_handler(sig);
+		return;
+	}
+
+	if (_snow.print.async.enabled) {
+		size_t from = __atomic_exchange_n(
+			&_snow.print.async.claimed, (size_t)-1, __ATOMIC_ACQ_REL);
+		if (from != (size_t)-1)
+			_snow_log_write_raw(from,
+				__atomic_load_n(&_snow.print.async.head, __ATOMIC_ACQUIRE));
+	}
+
+	sigaction(sig, old, NULL);
+	raise(sig);
+}
+
+/*
+ * Put back the signal handlers which were there before _snow_log_start.
+ */
+__attribute__((unused))
+static void _snow_log_restore_signals(void) {
+	static const int sigs[_SNOW_LOG_NUM_SIGNALS] = { _SNOW_LOG_SIGNALS };
+	for (size_t i = 0; i < _SNOW_LOG_NUM_SIGNALS; ++i) {
+		if (_snow.print.async.handled[i])
+			sigaction(sigs[i], &_snow.print.async.old_actions[i], NULL);
+		_snow.print.async.handled[i] = 0;
+	}
+}
+
+/*
+ * The --async-log writer thread, which drains the ring buffer
+ * into the log files.
+ */
+__attribute__((unused))
+static void *_snow_log_writer(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&_snow.print.async.mutex);
+	while (1) {
+		size_t tail = _snow.print.async.tail;
+		size_t head = __atomic_load_n(&_snow.print.async.head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			if (_snow.print.async.done)
+				break;
+			pthread_cond_wait(&_snow.print.async.cond, &_snow.print.async.mutex);
+			continue;
+		}
+
+		// If a crash handler has taken over, it writes everything itself
+		pthread_mutex_unlock(&_snow.print.async.mutex);
+		size_t claimed = tail;
+		if (!__atomic_compare_exchange_n(&_snow.print.async.claimed,
+				&claimed, head, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return NULL;
+		_snow_log_write_raw(tail, head);
+		__atomic_store_n(&_snow.print.async.tail, head, __ATOMIC_RELEASE);
+		pthread_mutex_lock(&_snow.print.async.mutex);
+		pthread_cond_broadcast(&_snow.print.async.cond);
+	}
+	pthread_mutex_unlock(&_snow.print.async.mutex);
+	return NULL;
+}
+
+/*
+ * Copy 'len' bytes into the ring buffer, waiting for the writer thread
+ * if it's full.
+ */
+__attribute__((unused))
+static void _snow_log_push(const char *data, size_t len) {
+	while (len > 0) {
+		size_t head = _snow.print.async.head;
+		size_t tail = __atomic_load_n(&_snow.print.async.tail, __ATOMIC_ACQUIRE);
+		size_t space = SNOW_LOG_RING_SIZE - (head - tail);
+		if (space == 0) {
+			pthread_mutex_lock(&_snow.print.async.mutex);
+			while (_snow.print.async.tail == head - SNOW_LOG_RING_SIZE)
+				pthread_cond_wait(&_snow.print.async.cond, &_snow.print.async.mutex);
+			pthread_mutex_unlock(&_snow.print.async.mutex);
+			continue;
+		}
+
+		size_t start = head % SNOW_LOG_RING_SIZE;
+		size_t n = len;
+		if (n > space) n = space;
+		if (n > SNOW_LOG_RING_SIZE - start) n = SNOW_LOG_RING_SIZE - start;
+		memcpy(_snow.print.async.buf + start, data, n);
+		__atomic_store_n(&_snow.print.async.head, head + n, __ATOMIC_RELEASE);
+		data += n;
+		len -= n;
+	}
+
+	pthread_mutex_lock(&_snow.print.async.mutex);
+	pthread_cond_broadcast(&_snow.print.async.cond);
+	pthread_mutex_unlock(&_snow.print.async.mutex);
+}
+
+/*
+ * Wait until the writer thread has written everything.
+ */
+__attribute__((unused))
+static void _snow_log_flush(void) {
+	if (!_snow.print.async.enabled)
+		return;
+
+	pthread_mutex_lock(&_snow.print.async.mutex);
+	while (_snow.print.async.tail != _snow.print.async.head)
+		pthread_cond_wait(&_snow.print.async.cond, &_snow.print.async.mutex);
+	pthread_mutex_unlock(&_snow.print.async.mutex);
+}
+
+/*
+ * Write everything which is left, and stop the writer thread.
+ * Also called at exit, in case a test calls exit().
+ */
+__attribute__((unused))
+static void _snow_log_stop(void) {
+	if (!_snow.print.async.enabled)
+		return;
+
+	pthread_mutex_lock(&_snow.print.async.mutex);
+	_snow.print.async.done = 1;
+	pthread_cond_broadcast(&_snow.print.async.cond);
+	pthread_mutex_unlock(&_snow.print.async.mutex);
+	pthread_join(_snow.print.async.thread, NULL);
+
+	_snow_log_restore_signals();
+	_snow.print.async.enabled = 0;
+	pthread_mutex_destroy(&_snow.print.async.mutex);
+	pthread_cond_destroy(&_snow.print.async.cond);
+	_snow_free(_snow.print.async.buf);
+	_snow.print.async.buf = NULL;
+}
+
+/*
+ * Start printing through the ring buffer and the writer thread.
+ * Returns -1 if the thread can't be started.
+ */
+__attribute__((unused))
+static int _snow_log_start(void) {
+	for (size_t i = 0; i < _snow.print.files.length; ++i) {
+		FILE *f = *(FILE **)_snow_arr_get(&_snow.print.files, i);
+		fflush(f);
+		int fd = fileno(f);
+		_snow_arr_push(&_snow.print.fds, &fd);
+	}
+
+	_snow.print.async.buf = _snow_malloc(SNOW_LOG_RING_SIZE);
+	if (_snow.print.async.buf == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	pthread_mutex_init(&_snow.print.async.mutex, NULL);
+	pthread_cond_init(&_snow.print.async.cond, NULL);
+	if (pthread_create(
+			&_snow.print.async.thread, NULL, _snow_log_writer, NULL) != 0) {
+		pthread_mutex_destroy(&_snow.print.async.mutex);
+		pthread_cond_destroy(&_snow.print.async.cond);
+		_snow_free(_snow.print.async.buf);
+		_snow.print.async.buf = NULL;
+		return -1;
+	}
+
+	_snow.print.async.enabled = 1;
+
+	static int registered = 0;
+	if (!registered) {
+		atexit(_snow_log_stop);
+		registered = 1;
+	}
+
+	// Signals which were ignored stay ignored
+	static const int sigs[_SNOW_LOG_NUM_SIGNALS] = { _SNOW_LOG_SIGNALS };
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = _snow_log_crash;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	for (size_t i = 0; i < _SNOW_LOG_NUM_SIGNALS; ++i) {
+		struct sigaction *old = &_snow.print.async.old_actions[i];
+		if (sigaction(sigs[i], NULL, old) < 0 ||
+				(!(old->sa_flags & SA_SIGINFO) && old->sa_handler == SIG_IGN))
+			continue;
+		_snow.print.async.handled[i] =
+			sigaction(sigs[i], &action, NULL) == 0;
+	}
+	return 0;
+}
+#else
+__attribute__((unused))
+static void _snow_log_push(const char *data, size_t len) { (void)data; (void)len; }
+__attribute__((unused))
+static void _snow_log_flush(void) {}
+__attribute__((unused))
+static void _snow_log_stop(void) {}
+__attribute__((unused))
+static int _snow_log_start(void) { return -1; }
+#endif
+
+/*
+ * Printing
+ */
+
+/*
+ * Print to every log file, either directly or through the
+ * --async-log ring buffer.
+ */
+__attribute__((unused, format(printf, 1, 0)))
+static void _snow_vprint(const char *fmt, va_list va) {
+	if (_snow.print.async.enabled) {
+		char buf[1024];
+		va_list va2;
+		va_copy(va2, va);
+		int len = vsnprintf(buf, sizeof(buf), fmt, va2);
+		va_end(va2);
+		if (len < 0)
+			return;
+
+		if ((size_t)len < sizeof(buf)) {
+			_snow_log_push(buf, len);
+		} else {
+			char *big = _snow_malloc(len + 1);
+			vsnprintf(big, len + 1, fmt, va);
+			_snow_log_push(big, len);
+			_snow_free(big);
+		}
+		return;
+	}
+
+	if (_snow.print.files.length <= 1) {
+		vfprintf(_snow.print.file, fmt, va);
+		return;
+	}
+
+	for (size_t i = 0; i < _snow.print.files.length; ++i) {
+		va_list va2;
+		va_copy(va2, va);
+		vfprintf(*(FILE **)_snow_arr_get(&_snow.print.files, i), fmt, va2);
+		va_end(va2);
+	}
+}
+
+__attribute__((unused, format(printf, 1, 2)))
+static void _snow_printf(const char *fmt, ...) {
+	va_list va;
+	va_start(va, fmt);
+	_snow_thread.untracked += 1;
+	_snow_vprint(fmt, va);
+	_snow_thread.untracked -= 1;
+	va_end(va);
+}
+
+#define _snow_print(...) _snow_printf(__VA_ARGS__)
+
+/*
+ * The writer thread flushes --async-log output as soon as it can,
+ * so this only has to flush output which is printed directly.
+ */
+__attribute__((unused))
+static void _snow_print_flush(void) {
+	if (_snow.print.async.enabled)
+		return;
+
+	for (size_t i = 0; i < _snow.print.files.length; ++i)
+		fflush(*(FILE **)_snow_arr_get(&_snow.print.files, i));
+}
+
+__attribute__((unused))
+static void _snow_print_duration(double msec) {
+	if (msec < 0) msec = 0;
+	if (msec < 1) {
+		_snow_print("%.02fµs", msec * 1000);
+	} else if (msec < 1000) {
+		_snow_print("%.02fms", msec);
+	} else {
+		_snow_print("%.02fs", msec / 1000);
+	}
+}
+
+__attribute__((unused))
+static void _snow_print_msec(double msec) {
+	_snow_print("(");
+	_snow_print_duration(msec);
+	_snow_print(")");
+}
+
+__attribute__((unused))
+static void _snow_print_timer(double start_time) {
+	_snow_print_msec(_snow_now() - start_time);
+}
+
+__attribute__((unused))
+static void _snow_print_rate(double rate) {
+	if (rate < 1000) {
+		_snow_print("%.02f/s", rate);
+	} else if (rate < 1000000) {
+		_snow_print("%.02fk/s", rate / 1000);
+	} else if (rate < 1000000000) {
+		_snow_print("%.02fM/s", rate / 1000000);
+	} else {
+		_snow_print("%.02fG/s", rate / 1000000000);
+	}
+}
+
+/*
+ * The number of assertions the current test case has executed,
+ * on its own thread and on threads it started.
+ */
+__attribute__((unused))
+static unsigned long _snow_case_num_asserts(void) {
+	return _snow.current_case.num_asserts +
+		__atomic_load_n(&_snow.current_case.thread_asserts, __ATOMIC_RELAXED);
+}
+
+/*
+ * Print the number of assertions executed, and how many assertions
+ * per second that amounts to if we have timing information.
+ */
+__attribute__((unused))
+static void _snow_print_asserts(unsigned long num_asserts, double start_time) {
+	_snow_print("[%lu assert%s", num_asserts, num_asserts == 1 ? "" : "s");
+
+	double msec = _snow_now() - start_time;
+	if (_snow.opts[_SNOW_OPT_TIMER].boolval && msec > 0) {
+		_snow_print(", ");
+		_snow_print_rate(num_asserts / (msec / 1000));
+	}
+
+	_snow_print("]");
+}
+
+/*
+ * Whether to print each test case and desc as it runs,
+ * which we don't with --quiet or --progress.
+ */
+__attribute__((unused))
+static int _snow_print_cases(void) {
+	return
+		!_snow.opts[_SNOW_OPT_QUIET].boolval &&
+		!_snow.opts[_SNOW_OPT_PROGRESS].boolval;
+}
+
+/*
+ * Remove the --progress status line, so that something else can be printed.
+ */
+__attribute__((unused))
+static void _snow_progress_clear(void) {
+	if (!_snow.progress.drawn)
+		return;
+
+	_snow_print("\r\033[K");
+	_snow.progress.drawn = 0;
+}
+
+__attribute__((unused))
+static void _snow_print_eta(double sec) {
+	long s = (long)sec;
+	if (s < 60)
+		_snow_print("%lis", s);
+	else if (s < 60 * 60)
+		_snow_print("%lim%02lis", s / 60, s % 60);
+	else
+		_snow_print("%lih%02lim", s / (60 * 60), (s / 60) % 60);
+}
+
+/*
+ * Redraw the --progress status line: how many top-level describes and
+ * test cases are done, how many failed, how many test cases per second
+ * we're running, and when we'll be done at the rate describes are going.
+ * Test cases aren't known until their describe runs, so there's no total
+ * to count them against.
+ */
+__attribute__((unused))
+static void _snow_progress_draw(double now) {
+	_snow.progress.draw_time = now;
+	_snow_progress_clear();
+
+	_snow_print("[%i/%i] %i done",
+		_snow.progress.descs_done, _snow.progress.descs, _snow.progress.done);
+	if (_snow.progress.failed > 0) {
+		if (_snow.opts[_SNOW_OPT_COLOR].boolval)
+			_snow_print(", " SNOW_COLOR_FAIL "%i failed" SNOW_COLOR_RESET,
+				_snow.progress.failed);
+		else
+			_snow_print(", %i failed", _snow.progress.failed);
+	}
+
+	double sec = (now - _snow.progress.start_time) / 1000;
+	if (sec > 0 && _snow.progress.done > 0) {
+		_snow_print(", ");
+		_snow_print_rate(_snow.progress.done / sec);
+	}
+
+	int descs_left = _snow.progress.descs - _snow.progress.descs_done;
+	if (sec > 0 && _snow.progress.descs_done > 0 && descs_left > 0) {
+		_snow_print(", ETA ");
+		_snow_print_eta(descs_left * sec / _snow.progress.descs_done);
+	}
+
+	_snow.progress.drawn = 1;
+	_snow_print_flush();
+}
+
+/*
+ * Called when a test case is done. The status line is only redrawn every
+ * SNOW_PROGRESS_INTERVAL milliseconds, because with lots of short test
+ * cases, drawing it for every test case would be the bottleneck.
+ */
+__attribute__((unused))
+static void _snow_progress_case(int success) {
+	if (!_snow.opts[_SNOW_OPT_PROGRESS].boolval)
+		return;
+
+	_snow.progress.done += 1;
+	if (!success)
+		_snow.progress.failed += 1;
+
+	if (!_snow.progress.is_tty)
+		return;
+
+	double now = _snow_clock();
+	if (now - _snow.progress.draw_time >= SNOW_PROGRESS_INTERVAL)
+		_snow_progress_draw(now);
+}
+
+/*
+ * Print the throughput and fairness numbers from a stress test.
+ */
+__attribute__((unused))
+static void _snow_print_stress(void) {
+	_snow_print("[%i thread%s, %lu ops",
+		_snow.current_case.stress.threads,
+		_snow.current_case.stress.threads == 1 ? "" : "s",
+		_snow.current_case.stress.ops);
+
+	if (_snow.opts[_SNOW_OPT_TIMER].boolval &&
+			_snow.current_case.stress.msec > 0) {
+		_snow_print(", ");
+		_snow_print_rate(
+			_snow.current_case.stress.ops /
+			(_snow.current_case.stress.msec / 1000));
+		_snow_print(", fairness %.02f, spread %.02fx",
+			_snow.current_case.stress.fairness,
+			_snow.current_case.stress.spread);
+	}
+
+	_snow_print("]");
+}
+
+__attribute__((unused))
+static void _snow_print_io(void) {
+	struct _snow_io_stats *io = &_snow.current_case.io;
+	_snow_print("[%llu read%s, %llu B; %llu write%s, %llu B]",
+		io->reads, io->reads == 1 ? "" : "s", io->read_bytes,
+		io->writes, io->writes == 1 ? "" : "s", io->written_bytes);
+}
+
+/*
+ * Print the time per operation of each size in a sweep,
+ * and the complexity which fits them best.
+ */
+__attribute__((unused))
+static void _snow_print_sweep(void) {
+	if (!_snow_print_cases()) return;
+	if (!_snow.opts[_SNOW_OPT_TIMER].boolval) return;
+	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
+
+	struct _snow_arr *points = &_snow.current_case.sweep.points;
+	for (size_t i = 0; i < points->length; ++i) {
+		struct _snow_sweep_point *p = _snow_arr_get(points, i);
+		_snow_print("%s    n = %-10zu ", spaces, p->n);
+		_snow_print_msec(p->msec);
+		_snow_print("\n");
+	}
+
+	double error;
+	enum _snow_complexity complexity = _snow_sweep_fit(&error);
+	_snow_print("%s    Best fit: %s, rms error %.01f%%\n", spaces,
+		_snow_complexity_names[complexity], error * 100);
+}
+
+__attribute__((unused))
+static void _snow_print_case_begin(void) {
+	if (!_snow_print_cases()) return;
+	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
+
+	_snow.print.prev_print = _SNOW_PRINT_CASE;
+
+	if (!_snow.opts[_SNOW_OPT_MAYBES].boolval)
+		return;
+
+	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
+		_snow_print(
+			"%s" SNOW_COLOR_BOLD SNOW_COLOR_MAYBE "? "
+			SNOW_COLOR_RESET SNOW_COLOR_MAYBE "Testing: "
+			SNOW_COLOR_RESET SNOW_COLOR_DESC "%s: " SNOW_COLOR_RESET,
+			spaces, _snow.current_case.name);
+	} else {
+		_snow_print(
+			"%s? Testing: %s: ", spaces, _snow.current_case.name);
+	}
+
+	if (_snow.opts[_SNOW_OPT_CR].boolval) {
+		_snow.print.need_cr = 1;
+		_snow_print_flush();
+	} else {
+		_snow_print("\n");
+	}
+}
+
+__attribute__((unused))
+static void _snow_print_case_success(void) {
+	if (!_snow_print_cases()) return;
+	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
+
+	if (_snow.print.need_cr)
+		_snow_print(" \r");
+
+	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
+		_snow_print(
+			"%s" SNOW_COLOR_BOLD SNOW_COLOR_SUCCESS "✓ "
+			SNOW_COLOR_RESET SNOW_COLOR_SUCCESS "Success: "
+			SNOW_COLOR_RESET SNOW_COLOR_DESC "%s"
+			SNOW_COLOR_RESET,
+			spaces, _snow.current_case.name);
+	} else {
+		_snow_print(
+			"%s✓ Success: %s", spaces, _snow.current_case.name);
+	}
+
+	if (_snow.opts[_SNOW_OPT_TIMER].boolval) {
+		_snow_print(" ");
+		_snow_print_timer(_snow.current_case.start_time);
+	}
+
+	if (_snow.current_case.stress.threads > 0) {
+		_snow_print(" ");
+		_snow_print_stress();
+	}
+
+	if (_snow.io.fd >= 0) {
+		_snow_print(" ");
+		_snow_print_io();
+	}
+
+	if (_snow.opts[_SNOW_OPT_ASSERT_STATS].boolval) {
+		_snow_print(" ");
+		_snow_print_asserts(
+			_snow_case_num_asserts(), _snow.current_case.start_time);
+	}
+
+	_snow_print("\n");
+}
+
+__attribute__((unused))
+static void _snow_print_case_cached(void) {
+	if (!_snow_print_cases()) return;
+	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
+
+	_snow.print.prev_print = _SNOW_PRINT_CASE;
+
+	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
+		_snow_print(
+			"%s" SNOW_COLOR_BOLD SNOW_COLOR_SUCCESS "✓ "
+			SNOW_COLOR_RESET SNOW_COLOR_SUCCESS "Cached:  "
+			SNOW_COLOR_RESET SNOW_COLOR_DESC "%s"
+			SNOW_COLOR_RESET "\n",
+			spaces, _snow.current_case.name);
+	} else {
+		_snow_print(
+			"%s✓ Cached:  %s\n", spaces, _snow.current_case.name);
+	}
+}
+
+/*
+ * The time budget of the current test case in milliseconds,
+ * or 0 if it has none. A negative .budget_ms opts out of --max-case-time.
+ */
+__attribute__((unused))
+static double _snow_case_budget(void) {
+	if (_snow.current_case.opts.budget_ms > 0)
+		return _snow.current_case.opts.budget_ms;
+	if (_snow.current_case.opts.budget_ms < 0)
+		return 0;
+	return _snow.max_case_time;
+}
+
+__attribute__((unused))
+static void _snow_print_case_over_budget(void) {
+	if (!_snow_print_cases()) return;
+	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
+
+	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
+		_snow_print(
+			"%s    " SNOW_COLOR_BOLD SNOW_COLOR_MAYBE "Warning: "
+			SNOW_COLOR_RESET "Took ", spaces);
+	} else {
+		_snow_print("%s    Warning: Took ", spaces);
+	}
+
+	_snow_print_duration(_snow.current_case.over_budget);
+	_snow_print(", but the time budget is ");
+	_snow_print_duration(_snow_case_budget());
+	_snow_print(".\n");
+}
+
+__attribute__((unused))
+static void _snow_print_desc_begin_index(size_t index) {
+	if (index > 0) {
+		struct _snow_desc *parent = _snow_arr_get(&_snow.desc_stack, index - 1);
+		if (!parent->printed)
+			_snow_print_desc_begin_index(index - 1);
+	}
+
+	_snow_print("\n");
+	_snow.print.prev_print = _SNOW_PRINT_DESC_BEGIN;
+
+	struct _snow_desc *desc = _snow_arr_get(&_snow.desc_stack, index);
+	char *spaces = _snow_spaces(index);
+
+	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
+		_snow_print(
 			"%s" SNOW_COLOR_BOLD "Testing %s" SNOW_COLOR_RESET ":\n",
 			spaces, desc->name);
 	} else {
-		_snow_print("%sTesting %s:\n", spaces, desc->name);
+		_snow_print("%sTesting %s:\n", spaces, desc->name);
+	}
+
+	desc->printed = 1;
+}
+
+__attribute__((unused))
+static char *_snow_print_case_failure(void) {
+	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
+
+	// With --progress, descs are only printed if something in them fails
+	if (_snow.opts[_SNOW_OPT_PROGRESS].boolval) {
+		_snow_progress_clear();
+		if (!_snow.current_desc->printed) {
+			_snow_print_desc_begin_index(_snow.desc_stack.length - 1);
+			_snow.print.prev_print = _SNOW_PRINT_CASE;
+		}
+	}
+
+	if (_snow.print.need_cr)
+		_snow_print(" \r");
+
+	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
+		_snow_print(
+			"%s" SNOW_COLOR_BOLD SNOW_COLOR_FAIL "✕ "
+			SNOW_COLOR_RESET SNOW_COLOR_FAIL "Failed:  "
+			SNOW_COLOR_RESET SNOW_COLOR_DESC "%s"
+			SNOW_COLOR_RESET ":\n",
+			spaces, _snow.current_case.name);
+	} else {
+		_snow_print(
+			"%s✕ Failed:  %s:\n", spaces, _snow.current_case.name);
+	}
+
+	return spaces;
+}
+
+__attribute__((unused))
+static void _snow_print_desc_begin(void) {
+	if (!_snow_print_cases()) return;
+	_snow_print_desc_begin_index(_snow.desc_stack.length - 1);
+}
+
+__attribute__((unused))
+static void _snow_print_desc_end(void) {
+	if (_snow.opts[_SNOW_OPT_QUIET].boolval) return;
+	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
+	_snow_progress_clear();
+
+	if (_snow.print.prev_print != _SNOW_PRINT_CASE)
+		_snow_print("\n");
+	_snow.print.prev_print = _SNOW_PRINT_DESC_END;
+
+	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
+		_snow_print(
+			"%s" SNOW_COLOR_BOLD "%s: Passed %i/%i tests."
+			SNOW_COLOR_RESET,
+			spaces, _snow.current_desc->name,
+			_snow.current_desc->num_success, _snow.current_desc->num_tests);
+	} else {
+		_snow_print(
+			"%s%s: Passed %i/%i tests.",
+			spaces, _snow.current_desc->name,
+			_snow.current_desc->num_success, _snow.current_desc->num_tests);
+	}
+
+	if (_snow.opts[_SNOW_OPT_TIMER].boolval) {
+		_snow_print(" ");
+		_snow_print_timer(_snow.current_desc->start_time);
+	}
+
+	_snow_print("\n");
+}
+
+/*
+ * Time reports
+ */
+
+__attribute__((unused))
+static int _snow_times_enabled(void) {
+	return
+		_snow.opts[_SNOW_OPT_SLOWEST].strval != NULL &&
+		!_snow.opts[_SNOW_OPT_LIST].boolval;
+}
+
+/*
+ * Record how long a test case took, including its before_each,
+ * defers and after_each.
+ */
+__attribute__((unused))
+static void _snow_times_case(void) {
+	if (!_snow_times_enabled())
+		return;
+
+	const char *desc_name = _snow.current_desc->full_name;
+	size_t len = strlen(desc_name) + strlen(_snow.current_case.name) + 3;
+	struct _snow_case_time time;
+	time.name = _snow_malloc(len);
+	snprintf(time.name, len, "%s: %s", desc_name, _snow.current_case.name);
+	time.msec = _snow_now() - _snow.current_case.start_time;
+	time.index = _snow.times.cases.length;
+	_snow_arr_push(&_snow.times.cases, &time);
+}
+
+/*
+ * Descs are recorded when they begin, so that they can be
+ * printed as a tree in the same order as they ran.
+ */
+__attribute__((unused))
+static void _snow_times_desc_begin(void) {
+	if (!_snow_times_enabled())
+		return;
+
+	struct _snow_desc_time time = { 0 };
+	time.name = _snow.current_desc->name;
+	time.depth = _snow.desc_stack.length - 1;
+	_snow.current_desc->time_node = _snow.times.descs.length;
+	_snow_arr_push(&_snow.times.descs, &time);
+}
+
+__attribute__((unused))
+static void _snow_times_desc_end(void) {
+	if (!_snow_times_enabled())
+		return;
+
+	struct _snow_desc *desc = _snow.current_desc;
+	struct _snow_desc_time *time =
+		_snow_arr_get(&_snow.times.descs, desc->time_node);
+	time->num_tests = desc->num_tests;
+	time->total_msec = _snow_now() - desc->start_time;
+	time->self_msec = time->total_msec - desc->children_msec;
+
+	if (_snow.desc_stack.length > 1) {
+		struct _snow_desc *parent =
+			_snow_arr_get(&_snow.desc_stack, _snow.desc_stack.length - 2);
+		parent->children_msec += time->total_msec;
+	}
+}
+
+__attribute__((unused))
+static int _snow_times_compare(const void *a, const void *b) {
+	const struct _snow_case_time *ta = a;
+	const struct _snow_case_time *tb = b;
+	if (ta->msec != tb->msec)
+		return ta->msec < tb->msec ? 1 : -1;
+
+	// Slowest first, but otherwise in the order they ran
+	return ta->index < tb->index ? -1 : 1;
+}
+
+/*
+ * Print the slowest test cases, a histogram of test case durations,
+ * and the self and total time of each desc.
+ */
+__attribute__((unused))
+static void _snow_print_times(void) {
+	int max = atoi(_snow.opts[_SNOW_OPT_SLOWEST].strval);
+	struct _snow_arr *cases = &_snow.times.cases;
+	qsort(cases->elems, cases->length, cases->elem_size, _snow_times_compare);
+
+	_snow_print("Slowest tests:\n");
+	for (size_t i = 0; i < cases->length && (int)i < max; ++i) {
+		struct _snow_case_time *time = _snow_arr_get(cases, i);
+		_snow_print("%4zu. ", i + 1);
+		_snow_print_msec(time->msec);
+		_snow_print(" %s\n", time->name);
+	}
+
+	static const struct {
+		const char *label;
+		double max;
+	} buckets[] = {
+		{ "< 0.1ms", 0.1 },
+		{ "< 1ms",   1 },
+		{ "< 10ms",  10 },
+		{ "< 100ms", 100 },
+		{ "< 1s",    1000 },
+		{ "< 10s",   10000 },
+		{ ">= 10s",  -1 },
+	};
+	size_t nbuckets = sizeof(buckets) / sizeof(*buckets);
+	size_t counts[sizeof(buckets) / sizeof(*buckets)] = { 0 };
+	size_t max_count = 0;
+	for (size_t i = 0; i < cases->length; ++i) {
+		struct _snow_case_time *time = _snow_arr_get(cases, i);
+		size_t bucket = 0;
+		while (bucket < nbuckets - 1 && time->msec >= buckets[bucket].max)
+			bucket += 1;
+		counts[bucket] += 1;
+		if (counts[bucket] > max_count)
+			max_count = counts[bucket];
+	}
+
+	_snow_print("\nDurations:\n");
+	for (size_t i = 0; i < nbuckets; ++i) {
+		_snow_print("%10s: %5zu", buckets[i].label, counts[i]);
+		size_t width = max_count == 0 ? 0 :
+			(counts[i] * 40 + max_count - 1) / max_count;
+		if (width > 0)
+			_snow_print(" ");
+		for (size_t j = 0; j < width; ++j)
+			_snow_print("#");
+		_snow_print("\n");
+	}
+
+	_snow_print("\nTime per describe (self / total):\n");
+	for (size_t i = 0; i < _snow.times.descs.length; ++i) {
+		struct _snow_desc_time *time = _snow_arr_get(&_snow.times.descs, i);
+		if (time->num_tests == 0)
+			continue;
+
+		_snow_print("    %s%s: ", _snow_spaces(time->depth), time->name);
+		_snow_print_msec(time->self_msec);
+		_snow_print(" / ");
+		_snow_print_msec(time->total_msec);
+		_snow_print("\n");
+	}
+}
+
+/*
+ * Test drivers
+ */
+
+/*
+ * snow-run starts test binaries with SNOW_RESULT_FD set to the write end
+ * of a pipe. Snow writes a line to it for each test case, so the driver
+ * doesn't have to parse the output meant for humans:
+ *
+ *   begin <desc> <case>
+ *   case pass|fail|cached <msec> <desc> <case>
+ *   end <exit code>
+ *
+ * Fields are separated by tabs. 'begin' is written before a test case
+ * runs, so that the driver knows which test case crashed a process.
+ *
+ * SNOW_CLAIM_FD is a file which all processes running the same binary
+ * map. Every process goes through the same test cases in the same order,
+ * but only runs the ones it claims by incrementing 'next', so test cases
+ * are shared between however many processes the driver starts.
+ */
+__attribute__((unused))
+static int _snow_run_init(void) {
+#ifndef __MINGW32__
+	char *result_fd = getenv("SNOW_RESULT_FD");
+	char *claim_fd = getenv("SNOW_CLAIM_FD");
+	if (result_fd == NULL)
+		return 0;
+
+	// Processes the tests start shouldn't report to the driver too
+	_snow.run.result_fd = atoi(result_fd);
+	fcntl(_snow.run.result_fd, F_SETFD, FD_CLOEXEC);
+	unsetenv("SNOW_RESULT_FD");
+	if (claim_fd == NULL)
+		return 0;
+
+	unsetenv("SNOW_CLAIM_FD");
+#if SNOW_USE_MMAP != 0
+	int fd = atoi(claim_fd);
+	void *claims = mmap(
+		NULL, sizeof(*_snow.run.claims), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	close(fd);
+	if (claims == MAP_FAILED) {
+		perror("SNOW_CLAIM_FD");
+		return -1;
+	}
+
+	_snow.run.claims = claims;
+	_snow.run.need_claim = 1;
+	return 0;
+#else
+	fprintf(stderr, "Can't share test cases, because SNOW_USE_MMAP is 0.\n");
+	return -1;
+#endif
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Write a record with the current test case's names to the driver.
+ */
+__attribute__((unused))
+static void _snow_run_send(const char *head) {
+	char line[1024];
+	size_t len = snprintf(line, sizeof(line) - 1, "%s", head);
+	const char *names[] = { _snow.current_desc->full_name, _snow.current_case.name };
+	for (size_t i = 0; i < sizeof(names) / sizeof(*names); ++i) {
+		if (len < sizeof(line) - 1)
+			line[len++] = '\t';
+		for (const char *c = names[i]; *c != '\0' && len < sizeof(line) - 1; ++c)
+			line[len++] = *c == '\t' || *c == '\n' ? ' ' : *c;
+	}
+	line[len++] = '\n';
+
+	if (write(_snow.run.result_fd, line, len) < 0)
+		_snow.run.result_fd = -1;
+}
+
+/*
+ * Called by _snow_case_begin for each test case which would run.
+ * Returns 0 if another process claimed it. The next test case is only
+ * claimed once the last one is done, so that if a test case crashes
+ * the process, no other test case is lost with it.
+ */
+__attribute__((unused))
+static int _snow_case_claimed(void) {
+	if (_snow.run.claims != NULL) {
+		if (_snow.run.need_claim) {
+			_snow.run.claimed = __atomic_fetch_add(
+				&_snow.run.claims->next, 1, __ATOMIC_RELAXED);
+			_snow.run.need_claim = 0;
+		}
+		if (_snow.run.index++ < _snow.run.claimed)
+			return 0;
+		_snow.run.need_claim = 1;
+	}
+
+	if (_snow.run.result_fd >= 0)
+		_snow_run_send("begin");
+	return 1;
+}
+
+__attribute__((unused))
+static void _snow_run_case(const char *result) {
+	if (_snow.run.result_fd < 0)
+		return;
+
+	// Cached test cases didn't run at all
+	double msec = 0;
+	if (strcmp(result, "cached") != 0)
+		msec = _snow_now() - _snow.current_case.start_time;
+
+	char head[64];
+	snprintf(head, sizeof(head), "case\t%s\t%.2f", result, msec);
+	_snow_run_send(head);
+}
+
+/*
+ * Tell the driver that this process is done. Once one process has gone
+ * through every test case, the driver knows how many there are.
+ */
+__attribute__((unused))
+static void _snow_run_end(void) {
+	if (_snow.run.claims != NULL) {
+		__atomic_store_n(
+			&_snow.run.claims->total, _snow.run.index + 1, __ATOMIC_RELAXED);
+#if SNOW_USE_MMAP != 0
+		munmap(_snow.run.claims, sizeof(*_snow.run.claims));
+#endif
+		_snow.run.claims = NULL;
+	}
+
+	if (_snow.run.result_fd >= 0) {
+		char line[32];
+		int len = snprintf(line, sizeof(line), "end\t%i\n", _snow.exit_code);
+		if (write(_snow.run.result_fd, line, len) < 0)
+			_snow.run.result_fd = -1;
+		close(_snow.run.result_fd);
+		_snow.run.result_fd = -1;
+	}
+}
+
+/*
+ * Result cache
+ */
+
+#define _SNOW_HASH_INIT 14695981039346656037ULL
+
+// 64-bit FNV-1a
+__attribute__((unused))
+static uint64_t _snow_hash(uint64_t hash, const void *data, size_t len) {
+	const unsigned char *ptr = data;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= ptr[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+__attribute__((unused))
+static uint64_t _snow_hash_file(uint64_t hash, const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return _snow_hash(hash, "\0missing", sizeof("\0missing"));
+
+	char buf[16 * 1024];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		hash = _snow_hash(hash, buf, n);
+
+	close(fd);
+	return hash;
+}
+
+#ifdef __linux__
+/*
+ * Find the NT_GNU_BUILD_ID note in the executable's program headers.
+ */
+__attribute__((unused))
+static const unsigned char *_snow_build_id(size_t *len) {
+	const ElfW(Phdr) *phdrs = (const ElfW(Phdr) *)getauxval(AT_PHDR);
+	size_t phnum = getauxval(AT_PHNUM);
+	if (phdrs == NULL)
+		return NULL;
+
+	// The executable might be position independent
+	uintptr_t base = 0;
+	for (size_t i = 0; i < phnum; ++i) {
+		if (phdrs[i].p_type == PT_PHDR)
+			base = (uintptr_t)phdrs - phdrs[i].p_vaddr;
+	}
+
+	for (size_t i = 0; i < phnum; ++i) {
+		if (phdrs[i].p_type != PT_NOTE)
+			continue;
+
+		const unsigned char *ptr =
+			(const unsigned char *)(base + phdrs[i].p_vaddr);
+		const unsigned char *end = ptr + phdrs[i].p_memsz;
+		while (ptr + sizeof(ElfW(Nhdr)) <= end) {
+			const ElfW(Nhdr) *note = (const ElfW(Nhdr) *)ptr;
+			const unsigned char *name = ptr + sizeof(*note);
+			const unsigned char *desc = name + ((note->n_namesz + 3) & ~3);
+			if (note->n_type == 3 && note->n_namesz == 4 &&
+					memcmp(name, "GNU", 4) == 0) {
+				*len = note->n_descsz;
+				return desc;
+			}
+
+			ptr = desc + ((note->n_descsz + 3) & ~3);
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+/*
+ * Identify the test binary by its build-id, or by hashing it if it
+ * doesn't have one.
+ */
+__attribute__((unused))
+static uint64_t _snow_binary_id(const char *argv0) {
+#ifdef __linux__
+	(void)argv0;
+	size_t len;
+	const unsigned char *id = _snow_build_id(&len);
+	if (id != NULL)
+		return _snow_hash(_SNOW_HASH_INIT, id, len);
+	return _snow_hash_file(_SNOW_HASH_INIT, "/proc/self/exe");
+#else
+	return _snow_hash_file(_SNOW_HASH_INIT, argv0);
+#endif
+}
+
+__attribute__((unused))
+static void _snow_cache_path(char *buf, size_t size, uint64_t key) {
+	snprintf(buf, size, "%s/%016llx",
+		_snow.opts[_SNOW_OPT_CACHE].strval, (unsigned long long)key);
+}
+
+/*
+ * Add the contents of the files in 'paths' to the current desc's
+ * cache key. Used by snow_cache_inputs.
+ */
+__attribute__((unused))
+static void _snow_cache_inputs(const char **paths, size_t count) {
+	if (_snow.opts[_SNOW_OPT_CACHE].strval == NULL)
+		return;
+	if (_snow.opts[_SNOW_OPT_LIST].boolval || !_snow.current_desc->enabled)
+		return;
+
+	uint64_t hash = _snow.current_desc->cache_inputs;
+	for (size_t i = 0; i < count; ++i) {
+		hash = _snow_hash(hash, paths[i], strlen(paths[i]) + 1);
+		hash = _snow_hash_file(hash, paths[i]);
+	}
+
+	_snow.current_desc->cache_inputs = hash;
+}
+
+/*
+ * Check whether the current case passed before with the same binary,
+ * name and inputs.
+ */
+__attribute__((unused))
+static int _snow_cache_hit(void) {
+	if (_snow.opts[_SNOW_OPT_CACHE].strval == NULL)
+		return 0;
+
+	struct _snow_desc *desc = _snow.current_desc;
+	uint64_t key = _snow.cache_binary_id;
+	key = _snow_hash(key, &desc->cache_inputs, sizeof(desc->cache_inputs));
+	key = _snow_hash(key, desc->full_name, desc->full_name_len + 1);
+	key = _snow_hash(key,
+		_snow.current_case.name, strlen(_snow.current_case.name) + 1);
+
+	// Multiple cases in a desc may have the same name
+	key = _snow_hash(key, &desc->num_tests, sizeof(desc->num_tests));
+	_snow.current_case.cache_key = key;
+
+	char path[1024];
+	_snow_cache_path(path, sizeof(path), key);
+	return access(path, F_OK) == 0;
+}
+
+/*
+ * If the current case is in the cache, it's counted as a success
+ * without running.
+ */
+__attribute__((unused))
+static int _snow_case_cached(void) {
+	if (!_snow_cache_hit())
+		return 0;
+
+	struct _snow_desc *desc = _snow.current_desc;
+	desc->num_tests += 1;
+	desc->num_success += 1;
+	_snow.num_cached += 1;
+	_snow_print_case_cached();
+	_snow_run_case("cached");
+	_snow_progress_case(1);
+	return 1;
+}
+
+__attribute__((unused))
+static void _snow_cache_store(void) {
+	char path[1024];
+	_snow_cache_path(path, sizeof(path), _snow.current_case.cache_key);
+	FILE *f = fopen(path, "w");
+	if (f == NULL)
+		return;
+
+	fprintf(f, "%s: %s\n",
+		_snow.current_desc->full_name, _snow.current_case.name);
+	fclose(f);
+}
+
+/*
+ * Fixtures
+ */
+
+__attribute__((unused))
+static struct _snow_fixture *_snow_fixture_find(const char *name) {
+	for (size_t i = 0; i < _snow.fixtures.length; ++i) {
+		struct _snow_fixture *fixture = _snow_arr_get(&_snow.fixtures, i);
+		if (strcmp(fixture->name, name) == 0)
+			return fixture;
+	}
+
+	fprintf(stderr, "Unknown fixture: %s\n", name);
+	exit(EXIT_FAILURE);
+}
+
+__attribute__((unused))
+static void _snow_fixture_construct(struct _snow_fixture *fixture) {
+	if (fixture->constructed)
+		return;
+
+	fixture->value = fixture->setup();
+	fixture->constructed = 1;
+}
+
+__attribute__((unused))
+static void *_snow_fixture_get(const char *name) {
+	struct _snow_fixture *fixture = _snow_fixture_find(name);
+	_snow_fixture_construct(fixture);
+	return fixture->value;
+}
+
+__attribute__((unused))
+static void _snow_fixture_teardown(struct _snow_fixture *fixture) {
+	if (!fixture->constructed)
+		return;
+
+	if (fixture->teardown != NULL)
+		fixture->teardown(fixture->value);
+	fixture->value = NULL;
+	fixture->constructed = 0;
+}
+
+/*
+ * Called by snow_use_fixture, to make the current desc and its subdescs
+ * use a fixture.
+ */
+__attribute__((unused))
+static void _snow_use_fixture(const char *name) {
+	struct _snow_fixture *fixture = _snow_fixture_find(name);
+	_snow_arr_push(&_snow.current_desc->fixtures, &fixture);
+}
+
+/*
+ * Make a top-level describe use the fixtures it was given with
+ * snow_use_fixture_in.
+ */
+__attribute__((unused))
+static void _snow_desc_declared_fixtures(struct _snow_desc *desc) {
+	for (size_t i = 0; i < _snow.fixture_uses.length; ++i) {
+		struct _snow_fixture_use *use = _snow_arr_get(&_snow.fixture_uses, i);
+		if (strcmp(use->desc, desc->name) != 0)
+			continue;
+
+		struct _snow_fixture *fixture = _snow_fixture_find(use->fixture);
+		_snow_arr_push(&desc->fixtures, &fixture);
+	}
+}
+
+/*
+ * Call 'func' once for each fixture used by the current desc or its parents.
+ */
+__attribute__((unused))
+static void _snow_each_fixture(void (*func)(struct _snow_fixture *)) {
+	for (size_t i = 0; i < _snow.desc_stack.length; ++i) {
+		struct _snow_desc *desc = _snow_arr_get(&_snow.desc_stack, i);
+		for (size_t j = 0; j < desc->fixtures.length; ++j) {
+			struct _snow_fixture *fixture =
+				*(struct _snow_fixture **)_snow_arr_get(&desc->fixtures, j);
+
+			int seen = 0;
+			for (size_t k = 0; k < i && !seen; ++k) {
+				struct _snow_desc *parent = _snow_arr_get(&_snow.desc_stack, k);
+				for (size_t l = 0; l < parent->fixtures.length && !seen; ++l)
+					seen = *(struct _snow_fixture **)_snow_arr_get(
+						&parent->fixtures, l) == fixture;
+			}
+			for (size_t l = 0; l < j && !seen; ++l)
+				seen = *(struct _snow_fixture **)_snow_arr_get(
+					&desc->fixtures, l) == fixture;
+
+			if (!seen)
+				func(fixture);
+		}
+	}
+}
+
+/*
+ * Construct the fixtures the current test case uses, if they haven't
+ * been constructed already.
+ */
+__attribute__((unused))
+static void _snow_case_fixtures(void) {
+	_snow_each_fixture(_snow_fixture_construct);
+}
+
+/*
+ * Called once the describes are done, for the fixtures which are still
+ * around. Those are the ones used by a describe which didn't declare it
+ * with snow_use_fixture_in, since Snow only finds out by running it.
+ */
+__attribute__((unused))
+static void _snow_fixtures_teardown(void) {
+	for (size_t i = 0; i < _snow.fixtures.length; ++i)
+		_snow_fixture_teardown(_snow_arr_get(&_snow.fixtures, i));
+}
+
+/*
+ * Watch mode
+ */
+
+/*
+ * Called when a test case fails in a test run started by --watch,
+ * to tell the watcher which top-level describe to run first next time.
+ */
+__attribute__((unused))
+static void _snow_watch_report(void) {
+	struct _snow_desc *desc = _snow_arr_get(&_snow.desc_stack, 0);
+	size_t len = strlen(desc->name);
+	char *line = _snow_malloc(len + 1);
+	memcpy(line, desc->name, len);
+	line[len] = '\n';
+	if (write(_snow.watch_fd, line, len + 1) < 0)
+		_snow.watch_fd = -1;
+	_snow_free(line);
+}
+
+/*
+ * Check if 'name' is one of the lines in 'list'.
+ */
+__attribute__((unused))
+static int _snow_watch_has(const char *list, const char *name) {
+	size_t len = strlen(name);
+	while (*list != '\0') {
+		const char *end = strchr(list, '\n');
+		if (end == NULL)
+			end = list + strlen(list);
+		if ((size_t)(end - list) == len && strncmp(list, name, len) == 0)
+			return 1;
+		list = *end == '\0' ? end : end + 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Move the describes named in 'first' to the front,
+ * keeping them in the order they were declared.
+ */
+__attribute__((unused))
+static void _snow_watch_reorder(const char *first) {
+	struct _snow_arr funcs;
+	_snow_arr_init(&funcs, sizeof(struct _snow_desc_func));
+	for (int pass = 0; pass < 2; ++pass) {
+		for (size_t i = 0; i < _snow.desc_funcs.length; ++i) {
+			struct _snow_desc_func *df = _snow_arr_get(&_snow.desc_funcs, i);
+			if (_snow_watch_has(first, df->name) == (pass == 0))
+				_snow_arr_push(&funcs, df);
+		}
+	}
+
+	_snow_arr_reset(&_snow.desc_funcs);
+	_snow.desc_funcs = funcs;
+}
+
+/*
+ * Pick up the state a --watch supervisor passed to this test run.
+ * Returns 1 if this is such a test run.
+ */
+__attribute__((unused))
+static int _snow_watch_init(void) {
+#ifndef __MINGW32__
+	char *watch_fd = getenv("SNOW_WATCH_FD");
+	if (watch_fd == NULL)
+		return 0;
+
+	// Processes the tests start shouldn't report to the supervisor too
+	_snow.watch_fd = atoi(watch_fd);
+	fcntl(_snow.watch_fd, F_SETFD, FD_CLOEXEC);
+	unsetenv("SNOW_WATCH_FD");
+
+	char *first = getenv("SNOW_WATCH_FIRST");
+	if (first != NULL) {
+		_snow_watch_reorder(first);
+		unsetenv("SNOW_WATCH_FIRST");
+	}
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+#if defined(__linux__) && SNOW_USE_FORK != 0
+struct _snow_watch_file {
+	int wd;
+	char *name;
+};
+
+/*
+ * Watch the directory containing 'path' rather than 'path' itself,
+ * because linkers and editors tend to replace files rather than
+ * write to them.
+ */
+__attribute__((unused))
+static int _snow_watch_add(
+		int fd, struct _snow_arr *files, const char *path) {
+	const char *slash = strrchr(path, '/');
+	size_t dirlen = slash == NULL ? 1 : slash == path ? 1 : (size_t)(slash - path);
+	char *dir = _snow_malloc(dirlen + 1);
+	memcpy(dir, slash == NULL ? "." : path, dirlen);
+	dir[dirlen] = '\0';
+
+	struct _snow_watch_file file;
+	file.name = slash == NULL ? (char *)path : (char *)slash + 1;
+	file.wd = inotify_add_watch(fd, dir,
+		IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB);
+	if (file.wd < 0) {
+		perror(dir);
+		_snow_free(dir);
+		return -1;
+	}
+
+	_snow_free(dir);
+	_snow_arr_push(files, &file);
+	return 0;
+}
+
+/*
+ * Wait until one of the watched files changes, and then until
+ * there have been no changes for a little while.
+ */
+__attribute__((unused))
+static int _snow_watch_wait(int fd, struct _snow_arr *files) {
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	int changed = 0;
+	while (1) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int ret = poll(&pfd, 1, changed ? 200 : -1);
+		if (ret < 0 && errno == EINTR && _snow.watch_stopped) {
+			return 0;
+		} else if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret < 0) {
+			perror("poll");
+			return -1;
+		} else if (ret == 0) {
+			return 0;
+		}
+
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n <= 0) {
+			perror("inotify");
+			return -1;
+		}
+
+		for (char *ptr = buf; ptr < buf + n;) {
+			struct inotify_event *ev = (struct inotify_event *)ptr;
+			for (size_t i = 0; ev->len > 0 && i < files->length; ++i) {
+				struct _snow_watch_file *file = _snow_arr_get(files, i);
+				if (file->wd == ev->wd && strcmp(file->name, ev->name) == 0)
+					changed = 1;
+			}
+
+			ptr += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+/*
+ * Set by SIGINT, to stop watching and exit with the last run's status.
+ */
+__attribute__((unused))
+static void _snow_watch_sigint(int sig) {
+	(void)sig;
+	_snow.watch_stopped = 1;
+}
+
+/*
+ * Run the test binary once. Its output is passed on through _snow_print,
+ * and the number of lines it printed is returned in 'lines' so that the
+ * next run can be drawn over it. The names of the describes with failing
+ * tests are read from another pipe and returned in 'failed', one per line.
+ * Returns the test binary's exit status.
+ */
+__attribute__((unused))
+static int _snow_watch_run(
+		const char *exe, char **argv, char **failed, int *lines) {
+	int fds[2], out[2];
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		return -1;
+	}
+	if (pipe(out) < 0) {
+		perror("pipe");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	for (int i = 0; i < 2; ++i) {
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+		fcntl(out[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	_snow_print_flush();
+	fflush(stdout);
+	pid_t child = fork();
+	if (child < 0) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		close(out[0]);
+		close(out[1]);
+		return -1;
+	}
+
+	// Child; only the write end of the failures pipe survives the exec
+	if (child == 0) {
+		dup2(out[1], STDOUT_FILENO);
+		fcntl(fds[1], F_SETFD, 0);
+		char fdstr[16];
+		snprintf(fdstr, sizeof(fdstr), "%i", fds[1]);
+		setenv("SNOW_WATCH_FD", fdstr, 1);
+		if (*failed != NULL)
+			setenv("SNOW_WATCH_FIRST", *failed, 1);
+		execv(exe, argv);
+		perror(exe);
+		_exit(EXIT_FAILURE);
+	}
+
+	// Parent
+	close(fds[1]);
+	close(out[1]);
+	struct _snow_arr buf;
+	_snow_arr_init(&buf, sizeof(char));
+	struct pollfd pfds[2] = { { out[0], POLLIN, 0 }, { fds[0], POLLIN, 0 } };
+	*lines = 0;
+	while (pfds[0].fd >= 0 || pfds[1].fd >= 0) {
+		if (poll(pfds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if (pfds[0].revents != 0) {
+			char chunk[4096];
+			ssize_t n = read(out[0], chunk, sizeof(chunk));
+			if (n > 0) {
+				for (ssize_t i = 0; i < n; ++i)
+					*lines += chunk[i] == '\n';
+				_snow_print("%.*s", (int)n, chunk);
+				_snow_print_flush();
+			} else if (n == 0 || errno != EINTR) {
+				pfds[0].fd = -1;
+			}
+		}
+
+		if (pfds[1].revents != 0) {
+			_snow_arr_grow(&buf, buf.length + 1024);
+			ssize_t n = read(fds[0], buf.elems + buf.length, 1023);
+			if (n > 0)
+				buf.length += n;
+			else if (n == 0 || errno != EINTR)
+				pfds[1].fd = -1;
+		}
+	}
+	close(fds[0]);
+	close(out[0]);
+
+	_snow_free(*failed);
+	*failed = NULL;
+	if (buf.length > 0) {
+		_snow_arr_grow(&buf, buf.length + 1);
+		buf.elems[buf.length] = '\0';
+		*failed = buf.elems;
+	} else {
+		_snow_arr_reset(&buf);
+	}
+
+	int status;
+	while (waitpid(child, &status, 0) < 0) {
+		if (errno != EINTR) {
+			perror("waitpid");
+			return -1;
+		}
+	}
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
+
+/*
+ * The --watch supervisor: run the test binary with the same arguments
+ * every time it, or one of the --watch-file files, changes. With --cr,
+ * each run is drawn over the previous one. Runs until interrupted,
+ * and returns the exit status of the last run.
+ */
+__attribute__((unused))
+static int _snow_watch(int argc, char **argv) {
+	char exe[4096];
+	ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+	if (len < 0) {
+		perror("/proc/self/exe");
+		return EXIT_FAILURE;
+	}
+	exe[len] = '\0';
+
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0) {
+		perror("inotify_init1");
+		return EXIT_FAILURE;
+	}
+
+	// The test runs' output goes through a pipe, so they have to be
+	// told what we decided based on whether the output is a TTY
+	char **args = _snow_malloc(sizeof(*args) * (argc + 4));
+	args[0] = argv[0];
+	args[1] = _snow.opts[_SNOW_OPT_COLOR].boolval ? "--color" : "--no-color";
+	args[2] = _snow.opts[_SNOW_OPT_MAYBES].boolval ? "--maybes" : "--no-maybes";
+	args[3] = _snow.opts[_SNOW_OPT_CR].boolval ? "--cr" : "--no-cr";
+	for (int i = 1; i <= argc; ++i)
+		args[i + 3] = argv[i];
+
+	int ret = EXIT_FAILURE;
+	struct _snow_arr files;
+	_snow_arr_init(&files, sizeof(struct _snow_watch_file));
+	struct _snow_arr *paths = &_snow.opts[_SNOW_OPT_WATCH_FILE].listval;
+	if (_snow_watch_add(fd, &files, exe) < 0)
+		goto cleanup;
+	for (size_t i = 0; i < paths->length; ++i) {
+		if (_snow_watch_add(fd, &files, *(char **)_snow_arr_get(paths, i)) < 0)
+			goto cleanup;
+	}
+
+	struct sigaction act, old_act;
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = _snow_watch_sigint;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGINT, &act, &old_act);
+
+	char *failed = NULL;
+	int lines = -1;
+	while (!_snow.watch_stopped) {
+		// Go back to where the previous run started, and clear from there
+		if (_snow.opts[_SNOW_OPT_CR].boolval && lines > 0)
+			_snow_print("\r\033[%iF\033[J", lines);
+		else if (_snow.opts[_SNOW_OPT_CR].boolval && lines == 0)
+			_snow_print("\r\033[J");
+
+		int status = _snow_watch_run(exe, args, &failed, &lines);
+		if (status < 0)
+			break;
+		ret = status;
+		if (_snow.watch_stopped)
+			break;
+
+		_snow_print("Watching %zu file%s for changes...",
+			files.length, files.length == 1 ? "" : "s");
+		if (!_snow.opts[_SNOW_OPT_CR].boolval)
+			_snow_print("\n");
+		_snow_print_flush();
+		if (_snow_watch_wait(fd, &files) < 0)
+			break;
+	}
+	_snow_free(failed);
+	if (_snow.opts[_SNOW_OPT_CR].boolval)
+		_snow_print("\n");
+	sigaction(SIGINT, &old_act, NULL);
+
+cleanup:
+	_snow_arr_reset(&files);
+	_snow_free(args);
+	close(fd);
+	return ret;
+}
+#endif
+
+/*
+ * Tracing
+ */
+
+/*
+ * Append 'len' bytes to a growing, NUL-terminated char array.
+ */
+__attribute__((unused))
+static void _snow_buf_append_n(struct _snow_arr *buf, const char *str, size_t len) {
+	if (buf->length + len + 1 > buf->allocated) {
+		size_t size = buf->allocated > 0 ? buf->allocated : 256;
+		while (size < buf->length + len + 1)
+			size *= 2;
+		_snow_arr_grow(buf, size);
+	}
+
+	memcpy(buf->elems + buf->length, str, len);
+	buf->length += len;
+	buf->elems[buf->length] = '\0';
+}
+
+__attribute__((unused))
+static void _snow_buf_append(struct _snow_arr *buf, const char *str) {
+	_snow_buf_append_n(buf, str, strlen(str));
+}
+
+/*
+ * Append the first 'len' bytes of 'str', escaped for a JSON string.
+ */
+__attribute__((unused))
+static void _snow_buf_json_n(struct _snow_arr *buf, const char *str, size_t len) {
+	for (size_t i = 0; i < len && str[i] != '\0'; ++i) {
+		unsigned char c = str[i];
+		char esc[8];
+		if (c == '"' || c == '\\') {
+			esc[0] = '\\';
+			esc[1] = c;
+			_snow_buf_append_n(buf, esc, 2);
+		} else if (c < 0x20) {
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			_snow_buf_append_n(buf, esc, 6);
+		} else {
+			_snow_buf_append_n(buf, str + i, 1);
+		}
+	}
+}
+
+__attribute__((unused))
+static void _snow_buf_json(struct _snow_arr *buf, const char *str) {
+	_snow_buf_json_n(buf, str, strlen(str));
+}
+
+/*
+ * Copy 'str' into 'buf' as the contents of a JSON string,
+ * and return the new length of 'buf'.
+ */
+__attribute__((unused))
+static size_t _snow_json_escape(char *buf, size_t len, size_t size, const char *str) {
+	for (; *str != '\0' && len + 7 < size; ++str) {
+		unsigned char c = *str;
+		if (c == '"' || c == '\\') {
+			buf[len++] = '\\';
+			buf[len++] = c;
+		} else if (c < 0x20) {
+			len += snprintf(buf + len, size - len, "\\u%04x", c);
+		} else {
+			buf[len++] = c;
+		}
+	}
+
+	return len;
+}
+
+/*
+ * Write a trace event, in the Trace Event Format used by chrome://tracing
+ * and Perfetto. 'ph' is 'B' to begin a span or 'E' to end the current one.
+ * Each event is written with a single fwrite, so that events from
+ * different threads don't get mixed up.
+ */
+__attribute__((unused))
+static void _snow_trace_event(char ph, const char *cat, const char *name) {
+	if (_snow.trace.file == NULL)
+		return;
+
+	if (_snow_thread.is_case_thread)
+		_snow.trace.depth += ph == 'B' ? 1 : -1;
+
+	char buf[512];
+	size_t size = sizeof(buf) - 8;
+	size_t len = snprintf(buf, size,
+		"{\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%li,\"tid\":%lu",
+		ph, _snow_clock() * 1000, (long)getpid(), _snow_thread_id());
+
+	if (name != NULL) {
+		len += snprintf(buf + len, size - len, ",\"cat\":\"%s\",\"name\":\"", cat);
+		len = _snow_json_escape(buf, len, size, name);
+		buf[len++] = '"';
+	}
+
+	memcpy(buf + len, "},\n", 3);
+	fwrite(buf, 1, len + 3, _snow.trace.file);
+}
+
+/*
+ * End the spans which a failing assertion jumped out of, like a before_each
+ * or a span started by the test, so that only the test case's span is open.
+ */
+__attribute__((unused))
+static void _snow_trace_unwind(void) {
+	while (_snow.trace.file != NULL && _snow.trace.depth > _snow.trace.case_depth)
+		_snow_trace_event('E', NULL, NULL);
+}
+
+/*
+ * Whether descs and test cases should be traced, which they shouldn't
+ * when they're only listed.
+ */
+__attribute__((unused))
+static int _snow_tracing(void) {
+	return
+		_snow.trace.file != NULL &&
+		!_snow.opts[_SNOW_OPT_LIST].boolval;
+}
+
+/*
+ * Close the JSON array. Ending with a metadata event means that
+ * every other event can be followed by a comma.
+ */
+__attribute__((unused))
+static void _snow_trace_close(void) {
+	if (_snow.trace.file == NULL)
+		return;
+
+	fprintf(_snow.trace.file,
+		"{\"ph\":\"M\",\"pid\":%li,\"name\":\"process_name\","
+		"\"args\":{\"name\":\"snow\"}}\n]\n",
+		(long)getpid());
+	fclose(_snow.trace.file);
+	_snow.trace.file = NULL;
+}
+
+/*
+ * Listing
+ */
+
+__attribute__((unused))
+static int _snow_list_json(void) {
+	return strcmp(_snow.opts[_SNOW_OPT_FORMAT].strval, "json") == 0;
+}
+
+/*
+ * Write the current test case's ID to 'buf' and return it. The ID is the
+ * full name of its describe and its own name, like "vector.push/grows
+ * the vector". Test cases with the same name in the same describe get
+ * "#2", "#3" and so on appended, in the order they're in.
+ */
+__attribute__((unused))
+static const char *_snow_case_id(struct _snow_arr *buf) {
+	struct _snow_desc *desc = _snow.current_desc;
+	const char *name = _snow.current_case.name;
+	int dups = 0;
+	for (size_t i = 0; i < desc->case_names.length; ++i) {
+		if (strcmp(*(const char **)_snow_arr_get(&desc->case_names, i), name) == 0)
+			dups += 1;
+	}
+	_snow_arr_push(&desc->case_names, &name);
+
+	buf->length = 0;
+	_snow_buf_append(buf, desc->full_name);
+	_snow_buf_append(buf, "/");
+	_snow_buf_append(buf, name);
+	if (dups > 0) {
+		char num[16];
+		snprintf(num, sizeof(num), "#%i", dups + 1);
+		_snow_buf_append(buf, num);
+	}
+	return buf->elems;
+}
+
+/*
+ * Called by _snow_case_begin before anything else happens with a test
+ * case. With --run-id, returns 0 for every test case but one.
+ */
+__attribute__((unused))
+static int _snow_case_selected(void) {
+	const char *run_id = _snow.opts[_SNOW_OPT_RUN_ID].strval;
+	if (run_id == NULL)
+		return 1;
+
+	if (strcmp(_snow_case_id(&_snow.bufs.id), run_id) != 0)
+		return 0;
+
+	_snow.run_id_found = 1;
+	return 1;
+}
+
+/*
+ * Called by _snow_case_begin instead of running the case with --list.
+ * With --format=json, each test case is one line of a JSON array.
+ */
+__attribute__((unused))
+static void _snow_case_list(void) {
+	if (!_snow_list_json())
+		return;
+
+	const char *id = _snow_case_id(&_snow.bufs.id);
+
+	// Names and tags can be any length, so the line grows as needed
+	struct _snow_arr *buf = &_snow.bufs.list;
+	buf->length = 0;
+	_snow_buf_append(buf, _snow.num_listed > 0 ? ",\n{\"id\":\"" : "{\"id\":\"");
+	_snow_buf_json(buf, id);
+	_snow_buf_append(buf, "\",\"describe\":\"");
+	_snow_buf_json(buf, _snow.current_desc->full_name);
+	_snow_buf_append(buf, "\",\"name\":\"");
+	_snow_buf_json(buf, _snow.current_case.name);
+	_snow_buf_append(buf, "\",\"tags\":[");
+
+	// Tags are separated by commas
+	const char *tags = _snow.current_case.opts.tags;
+	int num_tags = 0;
+	while (tags != NULL && *tags != '\0') {
+		while (*tags == ' ' || *tags == ',')
+			tags += 1;
+		size_t tag_len = strcspn(tags, ", ");
+		if (tag_len == 0)
+			continue;
+
+		_snow_buf_append(buf, num_tags > 0 ? ",\"" : "\"");
+		_snow_buf_json_n(buf, tags, tag_len);
+		_snow_buf_append(buf, "\"");
+		num_tags += 1;
+		tags += tag_len;
+	}
+
+	_snow_buf_append(buf, "],\"file\":\"");
+	_snow_buf_json(buf, _snow.current_case.filename);
+	char line[32];
+	snprintf(line, sizeof(line), "\",\"line\":%i}", _snow.current_case.linenum);
+	_snow_buf_append(buf, line);
+	_snow_print("%s", buf->elems);
+	_snow.num_listed += 1;
+}
+
+/*
+ * Symbols
+ */
+
+#if SNOW_USE_BACKTRACE != 0
+__attribute__((unused))
+static int _snow_symbols_compare(const void *a, const void *b) {
+	const struct _snow_sym *sa = a;
+	const struct _snow_sym *sb = b;
+	if (sa->start != sb->start)
+		return sa->start < sb->start ? -1 : 1;
+	return 0;
+}
+
+/*
+ * dladdr only knows about exported symbols, so read the functions from
+ * the executable's own symbol table too, as long as it isn't stripped.
+ */
+__attribute__((unused))
+static void _snow_symbols_load_exe(void) {
+#ifdef __linux__
+	const ElfW(Phdr) *phdrs = (const ElfW(Phdr) *)getauxval(AT_PHDR);
+	size_t phnum = getauxval(AT_PHNUM);
+	if (phdrs == NULL)
+		return;
+
+	// The executable might be position independent
+	uintptr_t base = 0;
+	for (size_t i = 0; i < phnum; ++i) {
+		if (phdrs[i].p_type == PT_PHDR)
+			base = (uintptr_t)phdrs - phdrs[i].p_vaddr;
+	}
+
+	FILE *f = fopen("/proc/self/exe", "rb");
+	if (f == NULL)
+		return;
+
+	struct _snow_arr buf;
+	_snow_arr_init(&buf, 1);
+	size_t n;
+	do {
+		_snow_arr_grow(&buf, buf.length + 64 * 1024);
+		n = fread(buf.elems + buf.length, 1, buf.allocated - buf.length, f);
+		buf.length += n;
+	} while (n > 0);
+	fclose(f);
+
+	const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *)buf.elems;
+	if (buf.length < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+			ehdr->e_shoff + ehdr->e_shnum * sizeof(ElfW(Shdr)) > buf.length) {
+		_snow_arr_reset(&buf);
+		return;
+	}
+
+	const ElfW(Shdr) *shdrs = (const ElfW(Shdr) *)(buf.elems + ehdr->e_shoff);
+	for (size_t i = 0; i < ehdr->e_shnum; ++i) {
+		if (shdrs[i].sh_type != SHT_SYMTAB || shdrs[i].sh_link >= ehdr->e_shnum)
+			continue;
+
+		const ElfW(Shdr) *strtab = &shdrs[shdrs[i].sh_link];
+		if (shdrs[i].sh_offset + shdrs[i].sh_size > buf.length ||
+				strtab->sh_offset + strtab->sh_size > buf.length)
+			continue;
+
+		const ElfW(Sym) *syms = (const ElfW(Sym) *)(buf.elems + shdrs[i].sh_offset);
+		size_t nsyms = shdrs[i].sh_size / sizeof(*syms);
+		for (size_t j = 0; j < nsyms; ++j) {
+			if (ELF64_ST_TYPE(syms[j].st_info) != STT_FUNC ||
+					syms[j].st_value == 0 || syms[j].st_name >= strtab->sh_size)
+				continue;
+
+			struct _snow_sym sym;
+			sym.start = base + syms[j].st_value;
+			sym.end = sym.start + syms[j].st_size;
+			sym.name = buf.elems + strtab->sh_offset + syms[j].st_name;
+			_snow_arr_push(&_snow.symbols.syms, &sym);
+		}
+	}
+
+	qsort(_snow.symbols.syms.elems, _snow.symbols.syms.length,
+		_snow.symbols.syms.elem_size, _snow_symbols_compare);
+	_snow.symbols.exe = buf.elems;
+#endif
+}
+
+/*
+ * Get ready to symbolize backtraces. This also calls backtrace once,
+ * because the first call might load libgcc, which isn't safe to do
+ * in a signal handler or in malloc.
+ */
+__attribute__((unused))
+static void _snow_symbols_init(void) {
+	if (_snow.symbols.loaded)
+		return;
+
+	_snow.symbols.loaded = 1;
+	void *pcs[1];
+	backtrace(pcs, 1);
+
+#if SNOW_USE_DLADDR != 0
+	// dladdr is looked up at runtime, because its declaration needs _GNU_SOURCE
+	void *self = dlopen(NULL, RTLD_LAZY);
+	if (self != NULL)
+		*(void **)&_snow.symbols.dladdr = dlsym(self, "dladdr");
+#endif
+	_snow_symbols_load_exe();
+}
+
+/*
+ * Write the name of the function which 'pc' is in to 'buf'. Functions
+ * which neither dladdr nor the executable's symbol table know about
+ * are written as "file+0xoffset", which addr2line can resolve.
+ */
+__attribute__((unused))
+static void _snow_symbol(void *pc, char *buf, size_t size) {
+	struct _snow_dl_info info;
+	int found = _snow.symbols.dladdr != NULL && _snow.symbols.dladdr(pc, &info) != 0;
+	if (found && info.dli_sname != NULL) {
+		snprintf(buf, size, "%s", info.dli_sname);
+		return;
+	}
+
+	// Find the last symbol which starts at or before 'pc'
+	struct _snow_arr *syms = &_snow.symbols.syms;
+	size_t lo = 0, hi = syms->length;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		struct _snow_sym *sym = _snow_arr_get(syms, mid);
+		if (sym->start <= (uintptr_t)pc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo > 0) {
+		struct _snow_sym *sym = _snow_arr_get(syms, lo - 1);
+		if ((uintptr_t)pc < sym->end) {
+			snprintf(buf, size, "%s", sym->name);
+			return;
+		}
+	}
+
+	if (found && info.dli_fname != NULL) {
+		const char *name = strrchr(info.dli_fname, '/');
+		snprintf(buf, size, "%s+0x%lx",
+			name == NULL ? info.dli_fname : name + 1,
+			(unsigned long)((char *)pc - (char *)info.dli_fbase));
+		return;
+	}
+
+	snprintf(buf, size, "%p", pc);
+}
+
+/*
+ * Cut the frames which a backtrace shares with 'base' off its outer end.
+ * 'base' is a backtrace taken in a describe's function by a function
+ * which isn't inlined: base[0] is that function, and base[1] is in the
+ * describe's function. Everything after that is what called the describe,
+ * which is the same for every backtrace taken from code the describe ran.
+ * Backtraces taken on other threads don't share those frames.
+ */
+__attribute__((unused))
+static int _snow_backtrace_trim(
+		void **pcs, int depth, void **base, int base_depth) {
+	void **outer = base + 2;
+	int num_outer = base_depth - 2;
+	if (num_outer > 0 && depth > num_outer &&
+			memcmp(pcs + depth - num_outer, outer, num_outer * sizeof(*pcs)) == 0)
+		return depth - num_outer;
+	return depth;
+}
+
+__attribute__((unused))
+static void _snow_symbols_cleanup(void) {
+	_snow_arr_reset(&_snow.symbols.syms);
+	_snow_free(_snow.symbols.exe);
+	_snow.symbols.exe = NULL;
+	_snow.symbols.loaded = 0;
+}
+#else
+__attribute__((unused))
+static void _snow_symbols_cleanup(void) {}
+#endif
+
+/*
+ * Profiling
+ */
+
+// backtrace from a signal handler starts with the handler
+// and the kernel's signal trampoline
+#define _SNOW_PROFILE_SKIP 2
+
+#if SNOW_USE_BACKTRACE != 0
+/*
+ * Called on SIGPROF while a test case runs with --profile. The samples are
+ * preallocated, and backtrace has already been called once so that it
+ * doesn't have to load libgcc, which makes this safe in a signal handler.
+ * Samples can be taken on any thread, including ones started by the test.
+ */
+__attribute__((unused))
+static void _snow_profile_signal(int sig) {
+	(void)sig;
+	int saved_errno = errno;
+	size_t i = __atomic_fetch_add(
+		&_snow.profile.num_samples, 1, __ATOMIC_RELAXED);
+	if (i < SNOW_PROFILE_MAX_SAMPLES) {
+		struct _snow_profile_sample *sample = &_snow.profile.samples[i];
+		int depth = backtrace(sample->pcs, SNOW_PROFILE_DEPTH);
+		__atomic_store_n(&sample->depth, depth, __ATOMIC_RELEASE);
+	}
+	errno = saved_errno;
+}
+
+__attribute__((unused))
+static int _snow_profile_init(void) {
+	_snow.profile.samples = _snow_calloc(
+		SNOW_PROFILE_MAX_SAMPLES, sizeof(*_snow.profile.samples));
+	if (_snow.profile.samples == NULL) {
+		perror("calloc");
+		return -1;
+	}
+
+	_snow_symbols_init();
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = _snow_profile_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGPROF, &action, &_snow.profile.old_action) < 0) {
+		perror("sigaction");
+		_snow_free(_snow.profile.samples);
+		_snow.profile.samples = NULL;
+		return -1;
+	}
+
+	_snow.profile.enabled = 1;
+	return 0;
+}
+
+__attribute__((unused))
+static void _snow_profile_timer(long usec) {
+	struct itimerval timer;
+	timer.it_interval.tv_sec = usec / 1000000;
+	timer.it_interval.tv_usec = usec % 1000000;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/*
+ * Called right before a test case's body runs. Every sample taken in the
+ * body shares the frames which called the describe's function, so they're
+ * remembered here to be cut off from the samples later. This mustn't be
+ * inlined, so that the first frame is always this function.
+ */
+__attribute__((unused, noinline))
+static void _snow_profile_start(void) {
+	if (!_snow.profile.enabled)
+		return;
+
+	_snow.profile.base_depth =
+		backtrace(_snow.profile.base, SNOW_PROFILE_DEPTH);
+	__atomic_store_n(&_snow.profile.num_samples, 0, __ATOMIC_RELAXED);
+	_snow_profile_timer(SNOW_PROFILE_USEC);
+}
+
+__attribute__((unused))
+static int _snow_profile_compare(const void *a, const void *b) {
+	const struct _snow_profile_sample *sa = a;
+	const struct _snow_profile_sample *sb = b;
+	if (sa->depth != sb->depth)
+		return sa->depth < sb->depth ? -1 : 1;
+	return memcmp(sa->pcs, sb->pcs, sa->depth * sizeof(*sa->pcs));
+}
+
+/*
+ * Called when a test case's body is done. Stops the timer, and adds
+ * the test case's samples to the profile, with identical stacks
+ * counted together.
+ */
+__attribute__((unused))
+static void _snow_profile_stop(void) {
+	if (!_snow.profile.enabled)
+		return;
+
+	_snow_profile_timer(0);
+
+	size_t num = __atomic_load_n(&_snow.profile.num_samples, __ATOMIC_RELAXED);
+	if (num > SNOW_PROFILE_MAX_SAMPLES) {
+		_snow.profile.dropped += num - SNOW_PROFILE_MAX_SAMPLES;
+		num = SNOW_PROFILE_MAX_SAMPLES;
+	}
+
+	// Cut off the signal handler and the frames outside of the describe.
+	// A sample which is still being written has a depth of 0
+	size_t count = 0;
+	for (size_t i = 0; i < num; ++i) {
+		struct _snow_profile_sample *sample = &_snow.profile.samples[i];
+		int depth = __atomic_exchange_n(&sample->depth, 0, __ATOMIC_ACQUIRE);
+		if (depth <= _SNOW_PROFILE_SKIP)
+			continue;
+
+		depth -= _SNOW_PROFILE_SKIP;
+		void **pcs = sample->pcs + _SNOW_PROFILE_SKIP;
+		depth = _snow_backtrace_trim(pcs, depth,
+			_snow.profile.base, _snow.profile.base_depth);
+
+		struct _snow_profile_sample *dest = &_snow.profile.samples[count++];
+		memmove(dest->pcs, pcs, depth * sizeof(*pcs));
+		dest->depth = depth;
+	}
+
+	if (count == 0)
+		return;
+
+	qsort(_snow.profile.samples, count,
+		sizeof(*_snow.profile.samples), _snow_profile_compare);
+
+	struct _snow_profile_case pcase;
+	pcase.first_stack = _snow.profile.stacks.length;
+	pcase.num_stacks = 0;
+	pcase.samples = count;
+	pcase.index = _snow.profile.cases.length;
+	for (size_t i = 0; i < count; ++i) {
+		struct _snow_profile_sample *sample = &_snow.profile.samples[i];
+		if (i > 0 && _snow_profile_compare(sample, sample - 1) == 0) {
+			((struct _snow_profile_stack *)
+				_snow_arr_top(&_snow.profile.stacks))->count += 1;
+			continue;
+		}
+
+		struct _snow_profile_stack stack;
+		stack.depth = sample->depth;
+		stack.count = 1;
+		memcpy(stack.pcs, sample->pcs, sample->depth * sizeof(*sample->pcs));
+		_snow_arr_push(&_snow.profile.stacks, &stack);
+		pcase.num_stacks += 1;
+	}
+	for (size_t i = 0; i < count; ++i)
+		_snow.profile.samples[i].depth = 0;
+
+	// The desc names and the test case's name are the outermost frames,
+	// so that flame graphs group test cases by desc
+	const char *desc_name = _snow.current_desc->full_name;
+	size_t len = strlen(desc_name) + strlen(_snow.current_case.name) + 2;
+	pcase.name = _snow_malloc(len);
+	snprintf(pcase.name, len, "%s;%s", desc_name, _snow.current_case.name);
+	size_t desc_len = strlen(desc_name);
+	for (size_t i = 0; pcase.name[i] != '\0'; ++i) {
+		char *c = &pcase.name[i];
+		if (i < desc_len && *c == '.')
+			*c = ';';
+		else if (i > desc_len && (*c == ';' || *c == '\n'))
+			*c = ' ';
+	}
+	_snow_arr_push(&_snow.profile.cases, &pcase);
+}
+
+__attribute__((unused))
+static int _snow_profile_compare_lines(const void *a, const void *b) {
+	const struct _snow_profile_line *la = a;
+	const struct _snow_profile_line *lb = b;
+	return strcmp(la->text, lb->text);
+}
+
+/*
+ * Write the profile as folded stacks, which is what flamegraph.pl,
+ * speedscope and inferno read: one line per distinct stack,
+ * "desc;test case;outermost;...;innermost <samples>". Stacks which
+ * only differ in where in a function the samples were taken are the
+ * same once they're symbolized, so those are added up.
+ */
+__attribute__((unused))
+static int _snow_profile_write(const char *path) {
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	struct _snow_arr lines;
+	_snow_arr_init(&lines, sizeof(struct _snow_profile_line));
+	struct _snow_arr line;
+	_snow_arr_init(&line, 1);
+	char name[256];
+	char sep = ';', nul = '\0';
+	for (size_t i = 0; i < _snow.profile.cases.length; ++i) {
+		struct _snow_profile_case *pcase = _snow_arr_get(&_snow.profile.cases, i);
+		for (size_t j = 0; j < pcase->num_stacks; ++j) {
+			struct _snow_profile_stack *stack =
+				_snow_arr_get(&_snow.profile.stacks, pcase->first_stack + j);
+			line.length = 0;
+			for (size_t k = 0; pcase->name[k] != '\0'; ++k)
+				_snow_arr_push(&line, &pcase->name[k]);
+			for (int k = stack->depth - 1; k >= 0; --k) {
+				// Other than the innermost one, the frames are return
+				// addresses, which might be just past the end of the caller
+				_snow_symbol(
+					(char *)stack->pcs[k] - (k > 0), name, sizeof(name));
+				_snow_arr_push(&line, &sep);
+				for (char *c = name; *c != '\0'; ++c)
+					_snow_arr_push(&line, c);
+			}
+			_snow_arr_push(&line, &nul);
+
+			struct _snow_profile_line l;
+			l.text = _snow_malloc(line.length);
+			memcpy(l.text, line.elems, line.length);
+			l.count = stack->count;
+			_snow_arr_push(&lines, &l);
+		}
+
+		qsort(lines.elems, lines.length, lines.elem_size,
+			_snow_profile_compare_lines);
+		for (size_t j = 0; j < lines.length; ++j) {
+			struct _snow_profile_line *l = _snow_arr_get(&lines, j);
+			if (j + 1 < lines.length &&
+					_snow_profile_compare_lines(l, l + 1) == 0) {
+				l[1].count += l->count;
+			} else {
+				fprintf(f, "%s %lu\n", l->text, l->count);
+			}
+			_snow_free(l->text);
+		}
+		lines.length = 0;
+	}
+
+	_snow_arr_reset(&lines);
+	_snow_arr_reset(&line);
+	fclose(f);
+	return 0;
+}
+
+__attribute__((unused))
+static int _snow_profile_compare_cases(const void *a, const void *b) {
+	const struct _snow_profile_case *ca = a;
+	const struct _snow_profile_case *cb = b;
+	if (ca->samples != cb->samples)
+		return ca->samples < cb->samples ? 1 : -1;
+	return ca->index < cb->index ? -1 : 1;
+}
+
+__attribute__((unused))
+static int _snow_profile_compare_funcs(const void *a, const void *b) {
+	const struct _snow_profile_func *fa = a;
+	const struct _snow_profile_func *fb = b;
+	if (fa->count != fb->count)
+		return fa->count < fb->count ? 1 : -1;
+	return strcmp(fa->name, fb->name);
+}
+
+/*
+ * Print the test cases which took the most samples, and for each of them,
+ * the functions which the most samples were taken in.
+ */
+__attribute__((unused))
+static void _snow_print_profile(void) {
+	struct _snow_arr *cases = &_snow.profile.cases;
+	qsort(cases->elems, cases->length, cases->elem_size,
+		_snow_profile_compare_cases);
+
+	_snow_print("Profile (samples per test case, self time per function):\n");
+	if (cases->length == 0)
+		_snow_print("    No samples were taken.\n");
+	for (size_t i = 0; i < cases->length && i < 5; ++i) {
+		struct _snow_profile_case *pcase = _snow_arr_get(cases, i);
+		_snow_print("%4zu. %6lu %s\n", i + 1, pcase->samples, pcase->name);
+
+		struct _snow_arr funcs;
+		_snow_arr_init(&funcs, sizeof(struct _snow_profile_func));
+		for (size_t j = 0; j < pcase->num_stacks; ++j) {
+			struct _snow_profile_stack *stack =
+				_snow_arr_get(&_snow.profile.stacks, pcase->first_stack + j);
+			struct _snow_profile_func func;
+			if (stack->depth == 0)
+				snprintf(func.name, sizeof(func.name), "(unknown)");
+			else
+				_snow_symbol(stack->pcs[0], func.name, sizeof(func.name));
+			func.count = stack->count;
+
+			size_t k;
+			for (k = 0; k < funcs.length; ++k) {
+				struct _snow_profile_func *f = _snow_arr_get(&funcs, k);
+				if (strcmp(f->name, func.name) == 0) {
+					f->count += func.count;
+					break;
+				}
+			}
+			if (k == funcs.length)
+				_snow_arr_push(&funcs, &func);
+		}
+
+		qsort(funcs.elems, funcs.length, funcs.elem_size,
+			_snow_profile_compare_funcs);
+		for (size_t j = 0; j < funcs.length && j < 5; ++j) {
+			struct _snow_profile_func *f = _snow_arr_get(&funcs, j);
+			_snow_print("             %5.1f%% %s\n",
+				f->count * 100.0 / pcase->samples, f->name);
+		}
+		_snow_arr_reset(&funcs);
+	}
+
+	if (_snow.profile.dropped > 0) {
+		_snow_print(
+			"\n%lu samples were dropped; increase SNOW_PROFILE_MAX_SAMPLES.\n",
+			_snow.profile.dropped);
+	}
+}
+
+__attribute__((unused))
+static void _snow_profile_cleanup(void) {
+	for (size_t i = 0; i < _snow.profile.cases.length; ++i)
+		_snow_free(((struct _snow_profile_case *)
+			_snow_arr_get(&_snow.profile.cases, i))->name);
+	_snow_arr_reset(&_snow.profile.cases);
+	_snow_arr_reset(&_snow.profile.stacks);
+	if (!_snow.profile.enabled)
+		return;
+
+	sigaction(SIGPROF, &_snow.profile.old_action, NULL);
+	_snow_free(_snow.profile.samples);
+	_snow.profile.samples = NULL;
+	_snow.profile.enabled = 0;
+}
+#else
+__attribute__((unused))
+static int _snow_profile_init(void) {
+	fprintf(stderr, "Can't profile, because SNOW_USE_BACKTRACE is 0.\n");
+	return -1;
+}
+__attribute__((unused))
+static void _snow_profile_start(void) {}
+__attribute__((unused))
+static void _snow_profile_stop(void) {}
+__attribute__((unused))
+static int _snow_profile_write(const char *path) { (void)path; return 0; }
+__attribute__((unused))
+static void _snow_print_profile(void) {}
+__attribute__((unused))
+static void _snow_profile_cleanup(void) {}
+#endif
+
+/*
+ * Allocation tracking
+ */
+
+#ifdef SNOW_TRACK_ALLOCS
+__attribute__((unused))
+static size_t _snow_allocs_slot(void *ptr) {
+	uint64_t hash = ((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ull;
+	return (size_t)(hash >> 32) & (_snow.allocs.capacity - 1);
+}
+
+/*
+ * The table is shared by every thread, and malloc can't wait on a pthread
+ * mutex which might itself allocate, so it's protected by a spinlock.
+ */
+__attribute__((unused))
+static void _snow_allocs_lock(void) {
+	while (__atomic_test_and_set(&_snow.allocs.lock, __ATOMIC_ACQUIRE));
+}
+
+__attribute__((unused))
+static void _snow_allocs_unlock(void) {
+	__atomic_clear(&_snow.allocs.lock, __ATOMIC_RELEASE);
+}
+
+__attribute__((unused))
+static void _snow_allocs_put(struct _snow_alloc *alloc) {
+	size_t i = _snow_allocs_slot(alloc->ptr);
+	while (_snow.allocs.table[i].ptr != NULL)
+		i = (i + 1) & (_snow.allocs.capacity - 1);
+	_snow.allocs.table[i] = *alloc;
+	_snow.allocs.count += 1;
+}
+
+__attribute__((unused))
+static void _snow_allocs_grow(void) {
+	struct _snow_alloc *old = _snow.allocs.table;
+	size_t old_capacity = _snow.allocs.capacity;
+	_snow.allocs.capacity = old_capacity == 0 ? 1024 : old_capacity * 2;
+	_snow.allocs.table = _snow_calloc(
+		_snow.allocs.capacity, sizeof(*_snow.allocs.table));
+	_snow.allocs.count = 0;
+	for (size_t i = 0; i < old_capacity; ++i) {
+		if (old[i].ptr != NULL)
+			_snow_allocs_put(&old[i]);
+	}
+	_snow_free(old);
+}
+
+/*
+ * Called by malloc, calloc and realloc with every block they return.
+ * This mustn't be inlined, so that the backtrace always starts with
+ * this function and the malloc function which called it.
+ */
+__attribute__((unused, noinline))
+static void _snow_alloc_record(void *ptr, size_t size, void *caller) {
+	if (ptr == NULL || _snow_thread.untracked > 0 ||
+			!__atomic_load_n(&_snow.allocs.active, __ATOMIC_RELAXED))
+		return;
+
+	// The dynamic loader allocates things like the thread-local storage
+	// of new threads, and keeps them around to reuse them
+	if ((uintptr_t)caller - _snow.allocs.loader_start <
+			_snow.allocs.loader_end - _snow.allocs.loader_start)
+		return;
+
+	// backtrace might allocate the first time it's called on a thread
+	_snow_thread.untracked += 1;
+	struct _snow_alloc alloc;
+	alloc.ptr = ptr;
+	alloc.size = size;
+	alloc.depth = 0;
+#if SNOW_USE_BACKTRACE != 0
+	void *pcs[SNOW_ALLOC_DEPTH + 2];
+	int depth = backtrace(pcs, SNOW_ALLOC_DEPTH + 2);
+	if (depth > 2) {
+		alloc.depth = depth - 2;
+		memcpy(alloc.pcs, pcs + 2, alloc.depth * sizeof(*pcs));
+	}
+#endif
+
+	_snow_allocs_lock();
+	alloc.seq = _snow.allocs.seq++;
+	if ((_snow.allocs.count + 1) * 2 > _snow.allocs.capacity)
+		_snow_allocs_grow();
+	_snow_allocs_put(&alloc);
+	_snow_allocs_unlock();
+	_snow_thread.untracked -= 1;
+}
+
+/*
+ * Called by free before a block is freed, and by realloc after it has
+ * moved or freed one. Removing an entry
+ * shifts back the entries after it, so that lookups never have to skip
+ * over deleted entries.
+ */
+__attribute__((unused))
+static void _snow_alloc_forget(void *ptr) {
+	if (ptr == NULL || __atomic_load_n(&_snow.allocs.count, __ATOMIC_RELAXED) == 0)
+		return;
+
+	_snow_allocs_lock();
+	struct _snow_alloc *table = _snow.allocs.table;
+	size_t mask = _snow.allocs.capacity - 1;
+	size_t i = _snow_allocs_slot(ptr);
+	while (table[i].ptr != ptr) {
+		if (table[i].ptr == NULL) {
+			_snow_allocs_unlock();
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+
+	size_t j = i;
+	while (1) {
+		j = (j + 1) & mask;
+		if (table[j].ptr == NULL)
+			break;
+
+		// Entry j can fill the hole at i unless its own slot is in (i, j]
+		size_t k = _snow_allocs_slot(table[j].ptr);
+		if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+			table[i] = table[j];
+			i = j;
+		}
+	}
+
+	table[i].ptr = NULL;
+	_snow.allocs.count -= 1;
+	_snow_allocs_unlock();
+}
+
+/*
+ * Find where the dynamic loader is mapped. The first call to backtrace
+ * might load libgcc, which is best done before any allocations are tracked.
+ */
+__attribute__((unused))
+static void _snow_allocs_init(void) {
+#ifdef __linux__
+	uintptr_t base = getauxval(AT_BASE);
+	if (base != 0) {
+		const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *)base;
+		const ElfW(Phdr) *phdrs = (const ElfW(Phdr) *)(base + ehdr->e_phoff);
+		_snow.allocs.loader_start = base;
+		_snow.allocs.loader_end = base;
+		for (size_t i = 0; i < ehdr->e_phnum; ++i) {
+			uintptr_t end = base + phdrs[i].p_vaddr + phdrs[i].p_memsz;
+			if (phdrs[i].p_type == PT_LOAD && end > _snow.allocs.loader_end)
+				_snow.allocs.loader_end = end;
+		}
+	}
+#endif
+
+#if SNOW_USE_BACKTRACE != 0
+	void *pcs[1];
+	backtrace(pcs, 1);
+#endif
+}
+
+/*
+ * Start tracking allocations, before a test case's before_each. Like in
+ * _snow_profile_start, the backtrace of where the describe was called
+ * from is remembered, so that it can be cut off the allocation sites.
+ */
+__attribute__((unused, noinline))
+static void _snow_allocs_start(void) {
+#if SNOW_USE_BACKTRACE != 0
+	_snow.allocs.base_depth = backtrace(_snow.allocs.base, SNOW_ALLOC_DEPTH);
+#endif
+	__atomic_store_n(&_snow.allocs.active, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Stop tracking allocations, and forget about the ones which are left.
+ */
+__attribute__((unused))
+static void _snow_allocs_reset(void) {
+	__atomic_store_n(&_snow.allocs.active, 0, __ATOMIC_RELAXED);
+	_snow_allocs_lock();
+	if (_snow.allocs.count > 0) {
+		memset(_snow.allocs.table, 0,
+			_snow.allocs.capacity * sizeof(*_snow.allocs.table));
+		_snow.allocs.count = 0;
+	}
+	_snow_allocs_unlock();
+}
+
+__attribute__((unused))
+static int _snow_allocs_compare(const void *a, const void *b) {
+	const struct _snow_alloc *aa = a;
+	const struct _snow_alloc *ab = b;
+	return aa->seq < ab->seq ? -1 : 1;
+}
+
+/*
+ * Print the blocks which are still allocated, in the order they were
+ * allocated, with the backtraces of where they were allocated.
+ */
+__attribute__((unused))
+static void _snow_print_leaks(const char *spaces) {
+	struct _snow_arr leaks;
+	_snow_arr_init(&leaks, sizeof(struct _snow_alloc));
+	size_t bytes = 0;
+	_snow_allocs_lock();
+	for (size_t i = 0; i < _snow.allocs.capacity; ++i) {
+		if (_snow.allocs.table[i].ptr == NULL)
+			continue;
+
+		_snow_arr_push(&leaks, &_snow.allocs.table[i]);
+		bytes += _snow.allocs.table[i].size;
+	}
+	_snow_allocs_unlock();
+	qsort(leaks.elems, leaks.length, leaks.elem_size, _snow_allocs_compare);
+
+	_snow_print("%s    Leaked %zu bytes in %zu allocation%s.\n",
+		spaces, bytes, leaks.length, leaks.length == 1 ? "" : "s");
+	for (size_t i = 0; i < leaks.length && i < 5; ++i) {
+		struct _snow_alloc *alloc = _snow_arr_get(&leaks, i);
+		_snow_print("%s    %zu bytes allocated", spaces, alloc->size);
+#if SNOW_USE_BACKTRACE != 0
+		_snow_symbols_init();
+		int depth = _snow_backtrace_trim(alloc->pcs, alloc->depth,
+			_snow.allocs.base, _snow.allocs.base_depth);
+		_snow_print(depth > 0 ? " at:\n" : ".\n");
+		for (int j = 0; j < depth; ++j) {
+			char name[256];
+			_snow_symbol((char *)alloc->pcs[j] - 1, name, sizeof(name));
+			_snow_print("%s        %s\n", spaces, name);
+		}
+#else
+		_snow_print(".\n");
+#endif
+	}
+	if (leaks.length > 5)
+		_snow_print("%s    ... and %zu more.\n", spaces, leaks.length - 5);
+
+	_snow_arr_reset(&leaks);
+}
+
+__attribute__((unused))
+static void _snow_allocs_cleanup(void) {
+	_snow_allocs_reset();
+	_snow_free(_snow.allocs.table);
+	_snow.allocs.table = NULL;
+	_snow.allocs.capacity = 0;
+}
+
+/*
+ * The allocation functions which replace the C library's. They have to be
+ * defined once, in the same place as the rest of snow's globals.
+ */
+#define _snow_alloc_decls \
+	__attribute__((noinline)) void *malloc(size_t size) { \
+		void *ptr = __libc_malloc(size); \
+		_snow_alloc_record(ptr, size, __builtin_return_address(0)); \
+		return ptr; \
+	} \
+	__attribute__((noinline)) void *calloc(size_t num, size_t size) { \
+		void *ptr = __libc_calloc(num, size); \
+		_snow_alloc_record(ptr, num * size, __builtin_return_address(0)); \
+		return ptr; \
+	} \
+	__attribute__((noinline)) void *realloc(void *ptr, size_t size) { \
+		/* A failed realloc leaves the old block alone, */ \
+		/* and glibc's realloc(ptr, 0) frees it */ \
+		void *ret = __libc_realloc(ptr, size); \
+		if (ret != NULL || size == 0) \
+			_snow_alloc_forget(ptr); \
+		_snow_alloc_record(ret, size, __builtin_return_address(0)); \
+		return ret; \
+	} \
+	__attribute__((noinline)) void free(void *ptr) { \
+		_snow_alloc_forget(ptr); \
+		__libc_free(ptr); \
+	}
+#else
+__attribute__((unused))
+static void _snow_allocs_init(void) {}
+__attribute__((unused))
+static void _snow_allocs_start(void) {}
+__attribute__((unused))
+static void _snow_allocs_reset(void) {}
+__attribute__((unused))
+static void _snow_print_leaks(const char *spaces) { (void)spaces; }
+__attribute__((unused))
+static void _snow_allocs_cleanup(void) {}
+#define _snow_alloc_decls
+#endif
+
+/*
+ * Virtual time
+ */
+
+#ifdef SNOW_VIRTUAL_TIME
+__attribute__((unused))
+static int64_t _snow_vtime_ns(const struct timespec *ts) {
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+__attribute__((unused))
+static void _snow_vtime_ts(int64_t ns, struct timespec *ts) {
+	ts->tv_sec = ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+__attribute__((unused))
+static int64_t _snow_vtime_real(clockid_t clock) {
+	struct timespec ts;
+	_snow_clock_gettime(clock, &ts);
+	return _snow_vtime_ns(&ts);
+}
+
+/*
+ * While a test case runs, the virtual clocks stand still at the time it
+ * started, and only move when something sleeps or the test calls
+ * snow_advance_time. Gets the current virtual time of 'clock' and returns
+ * 1, or returns 0 if the real clock should be used, like for CPU clocks.
+ */
+__attribute__((unused))
+static int _snow_vtime_get(clockid_t clock, int64_t *ns) {
+	if (!__atomic_load_n(&_snow.vtime.active, __ATOMIC_ACQUIRE))
+		return 0;
+
+	int64_t offset = __atomic_load_n(&_snow.vtime.offset, __ATOMIC_RELAXED);
+	switch (clock) {
+	case CLOCK_REALTIME:
+#ifdef CLOCK_REALTIME_COARSE
+	case CLOCK_REALTIME_COARSE:
+#endif
+		*ns = _snow.vtime.realtime + offset;
+		return 1;
+	case CLOCK_MONOTONIC:
+#ifdef CLOCK_MONOTONIC_RAW
+	case CLOCK_MONOTONIC_RAW:
+#endif
+#ifdef CLOCK_MONOTONIC_COARSE
+	case CLOCK_MONOTONIC_COARSE:
+#endif
+#ifdef CLOCK_BOOTTIME
+	case CLOCK_BOOTTIME:
+#endif
+		*ns = _snow.vtime.monotonic + offset;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Move virtual time forward by 'ns'. When several threads sleep at
+ * the same time, time moves to the latest of their wake-up times,
+ * rather than by the sum of their sleeps.
+ */
+__attribute__((unused))
+static void _snow_vtime_advance(int64_t ns) {
+	int64_t offset = __atomic_load_n(&_snow.vtime.offset, __ATOMIC_RELAXED);
+	int64_t target = offset + ns;
+	while (offset < target && !__atomic_compare_exchange_n(
+			&_snow.vtime.offset, &offset, target, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+ * Look up the C library's own clock_gettime, which the one tests get
+ * forwards to whenever virtual time isn't active.
+ */
+__attribute__((unused))
+static void _snow_vtime_init(void) {
+#if _SNOW_LIBC_HAS_DL != 0
+	void *libc = dlopen(LIBC_SO, RTLD_LAZY | RTLD_NOLOAD);
+	if (libc != NULL)
+		*(void **)&_snow.vtime.clock_gettime = dlsym(libc, "clock_gettime");
+#endif
+}
+
+/*
+ * Called before a test case's before_each.
+ */
+__attribute__((unused))
+static void _snow_vtime_start(void) {
+	_snow.vtime.realtime = _snow_vtime_real(CLOCK_REALTIME);
+	_snow.vtime.monotonic = _snow_vtime_real(CLOCK_MONOTONIC);
+	__atomic_store_n(&_snow.vtime.offset, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_snow.vtime.active, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Called after a test case's after_each.
+ */
+__attribute__((unused))
+static void _snow_vtime_stop(void) {
+	__atomic_store_n(&_snow.vtime.active, 0, __ATOMIC_RELEASE);
+}
+
+__attribute__((unused))
+static int _snow_vtime_clock_gettime(clockid_t clock, struct timespec *ts) {
+	int64_t ns;
+	if (!_snow_vtime_get(clock, &ns))
+		return _snow_clock_gettime(clock, ts);
+
+	_snow_vtime_ts(ns, ts);
+	return 0;
+}
+
+/*
+ * Returns an error number, like clock_nanosleep.
+ */
+__attribute__((unused))
+static int _snow_vtime_clock_nanosleep(
+		clockid_t clock, int flags,
+		const struct timespec *req, struct timespec *rem) {
+	int64_t now;
+	if (!_snow_vtime_get(clock, &now)) {
+		if (syscall(SYS_clock_nanosleep, clock, flags, req, rem) < 0)
+			return errno;
+		return 0;
+	}
+
+	if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000)
+		return EINVAL;
+
+	if (flags & TIMER_ABSTIME)
+		_snow_vtime_advance(_snow_vtime_ns(req) - now);
+	else
+		_snow_vtime_advance(_snow_vtime_ns(req));
+	if (rem != NULL && !(flags & TIMER_ABSTIME))
+		rem->tv_sec = rem->tv_nsec = 0;
+	return 0;
+}
+
+__attribute__((unused))
+static int _snow_vtime_nanosleep(const struct timespec *req, struct timespec *rem) {
+	int err = _snow_vtime_clock_nanosleep(CLOCK_MONOTONIC, 0, req, rem);
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+// Older glibc declares gettimeofday with a struct timezone pointer
+#if defined(__GLIBC__) && !defined(__UCLIBC__)
+# if __GLIBC_PREREQ(2, 31)
+typedef void *_snow_timezone_ptr;
+# else
+typedef struct timezone *_snow_timezone_ptr;
+# endif
+#else
+typedef void *_snow_timezone_ptr;
+#endif
+
+/*
+ * The clock and sleep functions which replace the C library's.
+ * They have to be defined once, with snow's globals.
+ */
+#define _snow_vtime_decls \
+	int clock_gettime(clockid_t clock, struct timespec *ts) { \
+		return _snow_vtime_clock_gettime(clock, ts); \
+	} \
+	int gettimeofday(struct timeval *tv, _snow_timezone_ptr tz) { \
+		struct timespec ts; \
+		_snow_vtime_clock_gettime(CLOCK_REALTIME, &ts); \
+		tv->tv_sec = ts.tv_sec; \
+		tv->tv_usec = ts.tv_nsec / 1000; \
+		if (tz != NULL) \
+			memset(tz, 0, sizeof(struct timezone)); \
+		return 0; \
+	} \
+	time_t time(time_t *t) { \
+		struct timespec ts; \
+		_snow_vtime_clock_gettime(CLOCK_REALTIME, &ts); \
+		if (t != NULL) \
+			*t = ts.tv_sec; \
+		return ts.tv_sec; \
+	} \
+	int clock_nanosleep( \
+			clockid_t clock, int flags, \
+			const struct timespec *req, struct timespec *rem) { \
+		return _snow_vtime_clock_nanosleep(clock, flags, req, rem); \
+	} \
+	int nanosleep(const struct timespec *req, struct timespec *rem) { \
+		return _snow_vtime_nanosleep(req, rem); \
+	} \
+	int usleep(useconds_t usec) { \
+		struct timespec ts; \
+		ts.tv_sec = usec / 1000000; \
+		ts.tv_nsec = (usec % 1000000) * 1000; \
+		return _snow_vtime_nanosleep(&ts, NULL); \
+	} \
+	unsigned int sleep(unsigned int seconds) { \
+		struct timespec ts, rem; \
+		ts.tv_sec = seconds; \
+		ts.tv_nsec = 0; \
+		if (_snow_vtime_nanosleep(&ts, &rem) < 0) \
+			return rem.tv_sec + (rem.tv_nsec > 0); \
+		return 0; \
+	}
+#else
+__attribute__((unused))
+static void _snow_vtime_init(void) {}
+__attribute__((unused))
+static void _snow_vtime_start(void) {}
+__attribute__((unused))
+static void _snow_vtime_stop(void) {}
+#define _snow_vtime_decls
+#endif
+
+/*
+ * Sanitizers
+ */
+
+/*
+ * When the test binary is built with ASan, UBSan or TSan, errors they
+ * report are attributed to the test case which was running. These are
+ * weak, so that they're NULL without the sanitizer runtimes.
+ */
+#ifdef __ELF__
+__attribute__((weak))
+void __sanitizer_set_death_callback(void (*callback)(void));
+__attribute__((weak))
+void __asan_set_error_report_callback(void (*callback)(const char *));
+__attribute__((weak))
+void __ubsan_get_current_report_data(
+	const char **kind, const char **message, const char **filename,
+	unsigned *line, unsigned *col, char **addr);
+void __ubsan_on_report(void);
+void __tsan_on_report(void *report);
+#endif
+
+/*
+ * Called for every error a sanitizer reports, on whichever thread
+ * caused it. The first one is remembered, and fails the test case
+ * in _snow_case_end unless the sanitizer aborts first.
+ */
+__attribute__((unused))
+__attribute__((format(printf, 1, 2)))
+static void _snow_sanitizer_report(const char *fmt, ...) {
+	if (!_snow.in_case)
+		return;
+
+	if (__atomic_fetch_add(
+			&_snow.current_case.sanitizer.errors, 1, __ATOMIC_RELAXED) == 0) {
+		va_list va;
+		va_start(va, fmt);
+		vsnprintf(
+			_snow.current_case.sanitizer.msg,
+			sizeof(_snow.current_case.sanitizer.msg), fmt, va);
+		va_end(va);
+		__atomic_store_n(&_snow.current_case.sanitizer.ready, 1, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * ASan passes the whole report; the line with "ERROR: " says what happened.
+ */
+__attribute__((unused))
+static void _snow_sanitizer_asan_report(const char *report) {
+	const char *error = strstr(report, "ERROR: ");
+	if (error == NULL) {
+		_snow_sanitizer_report("AddressSanitizer reported an error.");
+		return;
+	}
+
+	error += strlen("ERROR: ");
+	int len = strcspn(error, "\n");
+	_snow_sanitizer_report("%.*s", len, error);
+}
+
+/*
+ * Print the failure for the message of the first sanitizer error.
+ */
+__attribute__((unused))
+static void _snow_print_sanitizer_failure(void) {
+	char *spaces = _snow_print_case_failure();
+	int errors = __atomic_load_n(
+		&_snow.current_case.sanitizer.errors, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&_snow.current_case.sanitizer.ready, __ATOMIC_ACQUIRE))
+		_snow_print("%s    %s\n", spaces, _snow.current_case.sanitizer.msg);
+	else
+		_snow_print("%s    A sanitizer reported an error.\n", spaces);
+	if (errors > 1)
+		_snow_print("%s    (%i sanitizer errors in total)\n", spaces, errors);
+	_snow_print("%s    in %s:%i(%s)\n", spaces,
+		_snow.current_case.filename, _snow.current_case.linenum,
+		_snow.current_desc->full_name);
+}
+
+/*
+ * Called when a sanitizer is about to abort the test run, so that it's
+ * clear which test case it was in. With --fork-cases, only the test
+ * case's process dies, and the parent reports it.
+ */
+__attribute__((unused))
+static void _snow_sanitizer_death(void) {
+	if (!_snow.in_case || _snow.fork.is_child)
+		return;
+
+	_snow_print_sanitizer_failure();
+	_snow_print("\nA sanitizer aborted the test run.\n");
+	_snow_print_flush();
+	_snow_log_stop();
+}
+
+__attribute__((unused))
+static void _snow_sanitizer_init(void) {
+#ifdef __ELF__
+	if (__sanitizer_set_death_callback != NULL)
+		__sanitizer_set_death_callback(_snow_sanitizer_death);
+	if (__asan_set_error_report_callback != NULL)
+		__asan_set_error_report_callback(_snow_sanitizer_asan_report);
+#endif
+}
+
+/*
+ * UBSan and TSan call these hooks, which they define as weak functions,
+ * for every error. They have to be defined once, with snow's globals.
+ */
+#ifdef __ELF__
+#define _snow_sanitizer_decls \
+	void __ubsan_on_report(void) { \
+		const char *kind, *message = NULL, *filename; \
+		unsigned line, col; \
+		char *addr; \
+		if (__ubsan_get_current_report_data != NULL) \
+			__ubsan_get_current_report_data( \
+				&kind, &message, &filename, &line, &col, &addr); \
+		if (message == NULL) \
+			_snow_sanitizer_report("UndefinedBehaviorSanitizer reported an error."); \
+		else \
+			_snow_sanitizer_report("%s:%u:%u: runtime error: %s", \
+				filename, line, col, message); \
+	} \
+	void __tsan_on_report(void *report) { \
+		(void)report; \
+		_snow_sanitizer_report("ThreadSanitizer reported an error."); \
+	}
+#else
+#define _snow_sanitizer_decls
+#endif
+
+/*
+ * I/O accounting
+ */
+
+/*
+ * Open /proc/self/io for --io-stats. It's opened again by _snow_io_start
+ * in a forked test case, since the parent's file shows the parent's counters.
+ */
+__attribute__((unused))
+static int _snow_io_open(void) {
+#ifdef __linux__
+	_snow.io.fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+	if (_snow.io.fd < 0) {
+		perror("/proc/self/io");
+		return -1;
+	}
+	_snow.io.pid = getpid();
+	return 0;
+#else
+	fprintf(stderr, "--io-stats needs /proc/self/io, which only Linux has.\n");
+	return -1;
+#endif
+}
+
+__attribute__((unused))
+static void _snow_io_close(void) {
+	if (_snow.io.fd >= 0)
+		close(_snow.io.fd);
+	_snow.io.fd = -1;
+}
+
+/*
+ * Read the process's counters. Each read is itself a read syscall, which
+ * shows up in the counters the next time they're read, so it's added to
+ * the overhead which _snow_io_delta subtracts.
+ */
+__attribute__((unused))
+static int _snow_io_read(struct _snow_io_stats *stats) {
+#ifdef __linux__
+	char buf[512];
+	ssize_t n = pread(_snow.io.fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+
+	_snow.io.overhead.reads += 1;
+	_snow.io.overhead.read_bytes += n;
+	if (sscanf(buf, "rchar: %llu wchar: %llu syscr: %llu syscw: %llu",
+			&stats->read_bytes, &stats->written_bytes,
+			&stats->reads, &stats->writes) != 4)
+		return -1;
+	return 0;
+#else
+	(void)stats;
+	return -1;
+#endif
+}
+
+/*
+ * Called right before a test case's body.
+ */
+__attribute__((unused))
+static void _snow_io_start(void) {
+	if (_snow.io.fd < 0)
+		return;
+
+	if (_snow.io.pid != getpid()) {
+		close(_snow.io.fd);
+		if (_snow_io_open() < 0)
+			return;
+	}
+
+	memset(&_snow.io.start, 0, sizeof(_snow.io.start));
+	memset(&_snow.io.overhead, 0, sizeof(_snow.io.overhead));
+	_snow_io_read(&_snow.io.start);
+}
+
+/*
+ * The I/O done since _snow_io_start, not counting snow's own reads
+ * of /proc/self/io.
+ */
+__attribute__((unused))
+static void _snow_io_delta(struct _snow_io_stats *delta) {
+	struct _snow_io_stats overhead = _snow.io.overhead;
+	struct _snow_io_stats now;
+	if (_snow_io_read(&now) < 0) {
+		memset(delta, 0, sizeof(*delta));
+		return;
+	}
+
+	delta->reads = now.reads - _snow.io.start.reads - overhead.reads;
+	delta->writes = now.writes - _snow.io.start.writes - overhead.writes;
+	delta->read_bytes =
+		now.read_bytes - _snow.io.start.read_bytes - overhead.read_bytes;
+	delta->written_bytes =
+		now.written_bytes - _snow.io.start.written_bytes - overhead.written_bytes;
+}
+
+/*
+ * Called when a test case's body is done.
+ */
+__attribute__((unused))
+static void _snow_io_stop(void) {
+	if (_snow.io.fd >= 0)
+		_snow_io_delta(&_snow.current_case.io);
+}
+
+/*
+ * Benchmark environment
+ */
+
+/*
+ * The CPU this thread is running on, or -1 if we can't tell.
+ */
+__attribute__((unused))
+static int _snow_bench_getcpu(void) {
+#ifdef __linux__
+	unsigned int cpu;
+	if (syscall(SYS_getcpu, &cpu, NULL, NULL) < 0)
+		return -1;
+	return cpu;
+#else
+	return -1;
+#endif
+}
+
+/*
+ * How many times the scheduler has moved this thread to another CPU,
+ * or -1 if the kernel doesn't say (it needs CONFIG_SCHED_DEBUG).
+ */
+__attribute__((unused))
+static long _snow_bench_migrations(void) {
+#ifdef __linux__
+	FILE *f = fopen("/proc/thread-self/sched", "r");
+	if (f == NULL)
+		return -1;
+
+	char line[256];
+	long count = -1;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, "se.nr_migrations", 16) != 0)
+			continue;
+		char *colon = strchr(line, ':');
+		if (colon != NULL)
+			count = strtol(colon + 1, NULL, 10);
+		break;
+	}
+
+	fclose(f);
+	return count;
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Record which CPU a test case starts on, and the thread's migration count,
+ * so that _snow_bench_check_cpu can tell if it was moved to another CPU
+ * while it was being measured.
+ */
+__attribute__((unused))
+static void _snow_bench_case_begin(void) {
+	_snow.current_case.migrations = 0;
+	if (!_snow.opts[_SNOW_OPT_BENCH_ENV].boolval)
+		return;
+
+	_snow.current_case.start_cpu = _snow_bench_getcpu();
+	_snow.current_case.cpu = _snow.current_case.start_cpu;
+	_snow.current_case.start_migrations = _snow_bench_migrations();
+}
+
+/*
+ * The kernel's migration count catches every move, even one there and back
+ * between two checks. Without it, all we can do is to compare the CPU we're
+ * on now with the one we were on last time.
+ */
+__attribute__((unused))
+static void _snow_bench_check_cpu(void) {
+	int cpu = _snow_bench_getcpu();
+	long count = _snow.current_case.start_migrations >= 0
+		? _snow_bench_migrations() : -1;
+	if (count >= 0)
+		_snow.current_case.migrations =
+			count - _snow.current_case.start_migrations;
+	else if (cpu != _snow.current_case.cpu)
+		_snow.current_case.migrations += 1;
+	_snow.current_case.cpu = cpu;
+}
+
+/*
+ * Give a thread started by snow back the CPUs the test binary started with,
+ * instead of the one CPU which --bench-env pinned the test cases' thread to.
+ */
+__attribute__((unused))
+static void _snow_bench_unpin(void) {
+#ifdef __linux__
+	if (_snow.bench.pinned)
+		syscall(SYS_sched_setaffinity, 0,
+			sizeof(_snow.bench.mask), _snow.bench.mask);
+#endif
+}
+
+__attribute__((unused))
+static void _snow_print_case_migrated(void) {
+	if (!_snow_print_cases()) return;
+	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
+
+	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
+		_snow_print(
+			"%s    " SNOW_COLOR_BOLD SNOW_COLOR_MAYBE "Warning: "
+			SNOW_COLOR_RESET, spaces);
+	} else {
+		_snow_print("%s    Warning: ", spaces);
+	}
+
+	if (_snow.current_case.cpu != _snow.current_case.start_cpu)
+		_snow_print("Moved from CPU %i to CPU %i",
+			_snow.current_case.start_cpu, _snow.current_case.cpu);
+	else
+		_snow_print("Moved away from CPU %i and back",
+			_snow.current_case.start_cpu);
+	if (_snow.current_case.migrations > 1)
+		_snow_print(" (%i migrations)", _snow.current_case.migrations);
+	_snow_print(" while running.\n");
+}
+
+__attribute__((unused, format(printf, 1, 2)))
+static void _snow_print_bench_warning(const char *fmt, ...) {
+	if (_snow.opts[_SNOW_OPT_COLOR].boolval)
+		_snow_print(SNOW_COLOR_BOLD SNOW_COLOR_MAYBE "Warning: " SNOW_COLOR_RESET);
+	else
+		_snow_print("Warning: ");
+
+	va_list va;
+	va_start(va, fmt);
+	_snow_vprint(fmt, va);
+	va_end(va);
+	_snow_print("\n");
+}
+
+/*
+ * Read the first line of a file, like the ones in sysfs.
+ * Returns -1 if it can't be read.
+ */
+__attribute__((unused))
+static int _snow_bench_read(const char *path, char *buf, size_t size) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+
+	char *line = fgets(buf, size, f);
+	fclose(f);
+	if (line == NULL)
+		return -1;
+
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+/*
+ * Find the first 'key : value' line in /proc/cpuinfo with the given key.
+ */
+__attribute__((unused))
+static int _snow_bench_cpuinfo(const char *key, char *buf, size_t size) {
+	FILE *f = fopen("/proc/cpuinfo", "r");
+	if (f == NULL)
+		return -1;
+
+	char line[512];
+	int ret = -1;
+	size_t keylen = strlen(key);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *colon = strchr(line, ':');
+		if (colon == NULL || strncmp(line, key, keylen) != 0)
+			continue;
+		if (strspn(line + keylen, " \t") != (size_t)(colon - line) - keylen)
+			continue;
+
+		char *val = colon + 1 + strspn(colon + 1, " \t");
+		val[strcspn(val, "\n")] = '\0';
+		snprintf(buf, size, "%s", val);
+		ret = 0;
+		break;
+	}
+
+	fclose(f);
+	return ret;
+}
+
+/*
+ * Set up the machine for --bench-env: pin the test cases' thread to a CPU
+ * and raise its priority, warn about things which make timings unstable,
+ * and print what machine the numbers came from. Threads which snow starts
+ * itself get the original CPUs back with _snow_bench_unpin.
+ */
+__attribute__((unused))
+static void _snow_bench_env(void) {
+#ifdef __linux__
+	int cpu = _snow_bench_getcpu();
+	if (_snow.opts[_SNOW_OPT_BENCH_CPU].strval != NULL)
+		cpu = atoi(_snow.opts[_SNOW_OPT_BENCH_CPU].strval);
+
+	// The raw syscall, because cpu_set_t needs _GNU_SOURCE
+	unsigned long mask[1024 / (8 * sizeof(unsigned long))];
+	memset(mask, 0, sizeof(mask));
+	memset(_snow.bench.mask, 0, sizeof(_snow.bench.mask));
+	int pinned = 0;
+	errno = EINVAL;
+	if (cpu >= 0 && (size_t)cpu < sizeof(mask) * 8 &&
+			syscall(SYS_sched_getaffinity, 0,
+				sizeof(_snow.bench.mask), _snow.bench.mask) > 0) {
+		mask[cpu / (8 * sizeof(*mask))] |= 1UL << (cpu % (8 * sizeof(*mask)));
+		pinned = syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == 0;
+	}
+	if (!pinned)
+		_snow_print_bench_warning("Couldn't pin to CPU %i: %s",
+			cpu, strerror(errno));
+	_snow.bench.pinned = pinned;
+
+	// Get as high a priority as we're allowed to. Without privileges,
+	// that's usually where we started, so it's only shown in the summary.
+	int niceness = getpriority(PRIO_PROCESS, 0);
+	for (int prio = -20; prio < niceness; ++prio) {
+		if (setpriority(PRIO_PROCESS, 0, prio) == 0) {
+			niceness = prio;
+			break;
+		}
 	}
 
-	desc->printed = 1;
+	char path[128];
+	char governor[64] = "unknown";
+	snprintf(path, sizeof(path),
+		"/sys/devices/system/cpu/cpu%i/cpufreq/scaling_governor", cpu);
+	if (_snow_bench_read(path, governor, sizeof(governor)) == 0 &&
+			strcmp(governor, "performance") != 0)
+		_snow_print_bench_warning(
+			"The cpufreq governor is '%s', not 'performance'.", governor);
+
+	// intel_pstate has no_turbo, other drivers have boost
+	char val[16];
+	const char *turbo = "unknown";
+	if (_snow_bench_read(
+			"/sys/devices/system/cpu/intel_pstate/no_turbo", val, sizeof(val)) == 0)
+		turbo = strcmp(val, "0") == 0 ? "on" : "off";
+	else if (_snow_bench_read(
+			"/sys/devices/system/cpu/cpufreq/boost", val, sizeof(val)) == 0)
+		turbo = strcmp(val, "0") == 0 ? "off" : "on";
+	if (strcmp(turbo, "on") == 0)
+		_snow_print_bench_warning("Turbo boost is enabled.");
+
+	if (_snow.opts[_SNOW_OPT_QUIET].boolval)
+		return;
+
+	struct utsname uts;
+	if (uname(&uts) < 0)
+		memset(&uts, 0, sizeof(uts));
+
+	char model[256] = "unknown";
+	if (_snow_bench_cpuinfo("model name", model, sizeof(model)) < 0)
+		_snow_bench_cpuinfo("Model", model, sizeof(model));
+
+	_snow_print("Benchmark environment:\n");
+	_snow_print("    Host:     %s\n", uts.nodename);
+	_snow_print("    Kernel:   %s %s %s\n", uts.sysname, uts.release, uts.machine);
+	_snow_print("    CPU:      %s (%li online)\n",
+		model, sysconf(_SC_NPROCESSORS_ONLN));
+	if (pinned)
+		_snow_print("    Pinned:   CPU %i\n", cpu);
+	else
+		_snow_print("    Pinned:   no\n");
+	if (niceness > -20)
+		_snow_print("    Nice:     %i (couldn't raise it)\n", niceness);
+	else
+		_snow_print("    Nice:     %i\n", niceness);
+	_snow_print("    Governor: %s\n", governor);
+	_snow_print("    Turbo:    %s\n", turbo);
+#else
+	_snow_print_bench_warning(
+		"--bench-env can only pin and check the CPU on Linux.");
+#endif
+}
+
+/*
+ * Forked test cases
+ */
+
+struct _snow_fork_result {
+	int success;
+	unsigned long num_asserts;
+};
+
+/*
+ * Called in the child process when a forked test case is done,
+ * to report its result to the parent.
+ */
+__attribute__((unused))
+static void _snow_case_fork_exit(void) {
+	struct _snow_fork_result result;
+	result.success = _snow.current_case.success;
+	result.num_asserts = _snow_case_num_asserts();
+	fflush(NULL);
+	if (write(_snow.fork.result_fd, &result, sizeof(result)) < 0)
+		_exit(EXIT_FAILURE);
+	_exit(EXIT_SUCCESS);
 }
 
+/*
+ * Called once a test case, its defers and its after_each are all done,
+ * and the test case won't be re-run.
+ */
 __attribute__((unused))
-static void _snow_print_desc_begin(void) {
-	if (_snow.opts[_SNOW_OPT_QUIET].boolval) return;
-	_snow_print_desc_begin_index(_snow.desc_stack.length - 1);
+static void _snow_case_finish(void) {
+	// With --fork-cases, the parent does the rest when it gets the result
+	if (_snow.fork.is_child)
+		_snow_case_fork_exit();
+
+	_snow.num_asserts += _snow_case_num_asserts();
+	if (_snow.current_case.success && _snow.opts[_SNOW_OPT_CACHE].strval)
+		_snow_cache_store();
+	if (!_snow.current_case.success && _snow.watch_fd >= 0)
+		_snow_watch_report();
+	_snow_run_case(_snow.current_case.success ? "pass" : "fail");
+	_snow_times_case();
+	_snow_progress_case(_snow.current_case.success);
+	if (_snow.trace.file != NULL)
+		_snow_trace_event('E', NULL, NULL);
 }
 
+#if SNOW_USE_FORK != 0
+/*
+ * Fork before the test case's before_each. The child runs the before_each,
+ * the body, its defers and its after_each, so both hooks see the same
+ * state, while the parent waits for its result and then skips all of it.
+ */
 __attribute__((unused))
-static void _snow_print_desc_end(void) {
-	if (_snow.opts[_SNOW_OPT_QUIET].boolval) return;
-	char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
+static void _snow_case_fork(void) {
+	int fds[2];
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
 
-	if (_snow.print.prev_print != _SNOW_PRINT_CASE)
-		_snow_print("\n");
-	_snow.print.prev_print = _SNOW_PRINT_DESC_END;
+	_snow_log_flush();
+	fflush(NULL);
+	pid_t child = fork();
+	if (child < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
 
-	if (_snow.opts[_SNOW_OPT_COLOR].boolval) {
-		_snow_print(
-			"%s" SNOW_COLOR_BOLD "%s: Passed %i/%i tests."
-			SNOW_COLOR_RESET,
-			spaces, _snow.current_desc->name,
-			_snow.current_desc->num_success, _snow.current_desc->num_tests);
-	} else {
-		_snow_print(
-			"%s%s: Passed %i/%i tests.",
-			spaces, _snow.current_desc->name,
-			_snow.current_desc->num_success, _snow.current_desc->num_tests);
+	// Child
+	if (child == 0) {
+		// The writer thread only exists in the parent
+		_snow.print.async.enabled = 0;
+		close(fds[0]);
+		_snow.fork.is_child = 1;
+		_snow.fork.result_fd = fds[1];
+
+		// The migration count is per thread, and this is a new one
+		_snow_bench_case_begin();
+		return;
 	}
 
-	if (_snow.opts[_SNOW_OPT_TIMER].boolval) {
-		_snow_print(" ");
-		_snow_print_timer(_snow.current_desc->start_time);
+	// Parent
+	_snow_allocs_reset();
+	_snow_vtime_stop();
+	close(fds[1]);
+	struct _snow_fork_result result;
+	ssize_t n;
+	do {
+		n = read(fds[0], &result, sizeof(result));
+	} while (n < 0 && errno == EINTR);
+	close(fds[0]);
+
+	int status;
+	while (waitpid(child, &status, 0) < 0 && errno == EINTR);
+
+	_snow.in_case = 0;
+	if (n != sizeof(result)) {
+		char *spaces = _snow_print_case_failure();
+		if (WIFSIGNALED(status)) {
+			_snow_print("%s    Test case killed by signal %i.\n",
+				spaces, WTERMSIG(status));
+		} else {
+			_snow_print("%s    Test case exited with status %i.\n",
+				spaces, WEXITSTATUS(status));
+		}
+		_snow_print("%s    in %s\n", spaces, _snow.current_desc->full_name);
+		result.success = 0;
+		result.num_asserts = 0;
 	}
 
-	_snow_print("\n");
+	_snow.current_case.success = result.success;
+	_snow.current_case.num_asserts = result.num_asserts;
+	if (result.success)
+		_snow.current_desc->num_success += 1;
+	else
+		_snow.exit_code = EXIT_FAILURE;
+	_snow_case_finish();
 }
+#else
+__attribute__((unused))
+static void _snow_case_fork(void) {}
+#endif
 
 /*
  * Failing
  */
 
 #define snow_fail(...) \
-	if (_snow.rerunning_case) { \
-		snow_rerun_failed(); \
-	} \
 	do { \
+		if (!_snow_thread.is_case_thread) { \
+			_snow_fail_thread(__VA_ARGS__); \
+			break; \
+		} \
+		if (_snow.rerunning_case) { \
+			snow_rerun_failed(); \
+		} \
 		char *spaces = _snow_print_case_failure(); \
 		_snow_print("%s    ", spaces); \
 		_snow_print(__VA_ARGS__); \
 		_snow_print("\n"); \
 		_snow_print("%s    in %s:%i(%s)\n", spaces, \
-			_snow.filename, _snow.linenum, _snow.current_desc->full_name); \
+			_snow_thread.filename, _snow_thread.linenum, \
+			_snow.current_desc->full_name); \
 		_snow_case_end(0); \
 	} while (0)
 
@@ -546,20 +4721,70 @@ static void _snow_print_desc_end(void) {
 
 #define snow_fail_update() \
 	do { \
-		_snow.filename = __FILE__; \
-		_snow.linenum = __LINE__; \
+		_snow_thread.filename = __FILE__; \
+		_snow_thread.linenum = __LINE__; \
 	} while (0)
 
+/*
+ * Called by snow_fail when an assertion fails on a thread other than
+ * the one running the test case. We can't longjmp to the test case from
+ * here, so we record the first such failure and fail the test case once
+ * its body is done (which means after the test has joined its threads).
+ * The failing thread then bails out, either to the jmp_buf its creator
+ * set up, or by exiting the thread.
+ */
+__attribute__((unused))
+__attribute__((format(printf, 1, 2)))
+static void _snow_fail_thread(const char *fmt, ...) {
+	int expected = 0;
+	if (__atomic_compare_exchange_n(
+			&_snow.current_case.thread_fail.failed, &expected, -1,
+			0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		va_list va;
+		va_start(va, fmt);
+		vsnprintf(
+			_snow.current_case.thread_fail.msg,
+			sizeof(_snow.current_case.thread_fail.msg), fmt, va);
+		va_end(va);
+		_snow.current_case.thread_fail.filename = _snow_thread.filename;
+		_snow.current_case.thread_fail.linenum = _snow_thread.linenum;
+		_snow.current_case.thread_fail.thread_id = _snow_thread_id();
+		__atomic_store_n(
+			&_snow.current_case.thread_fail.failed, 1, __ATOMIC_RELEASE);
+	}
+
+	if (_snow_thread.bail_jmp != NULL)
+		longjmp(*_snow_thread.bail_jmp, 1);
+#if SNOW_USE_PTHREAD != 0
+	pthread_exit(NULL);
+#endif
+}
+
 __attribute__((unused))
 static void _snow_init(void) {
 	_snow_inited = 1;
 	memset(&_snow, 0, sizeof(_snow));
 	_snow.exit_code = EXIT_SUCCESS;
+	_snow.watch_fd = -1;
+	_snow.run.result_fd = -1;
+	_snow.io.fd = -1;
 	_snow_arr_init(&_snow.desc_funcs, sizeof(struct _snow_desc_func));
+	_snow_arr_init(&_snow.fixtures, sizeof(struct _snow_fixture));
+	_snow_arr_init(&_snow.fixture_uses, sizeof(struct _snow_fixture_use));
+	_snow_arr_init(&_snow.times.cases, sizeof(struct _snow_case_time));
+	_snow_arr_init(&_snow.times.descs, sizeof(struct _snow_desc_time));
 	_snow_arr_init(&_snow.desc_stack, sizeof(struct _snow_desc));
 	_snow_arr_init(&_snow.desc_patterns, sizeof(char *));
 	_snow_arr_init(&_snow.current_case.defers, sizeof(jmp_buf));
+	_snow_arr_init(&_snow.current_case.sweep.points, sizeof(struct _snow_sweep_point));
 	_snow_arr_init(&_snow.bufs.spaces, sizeof(char));
+	_snow_arr_init(&_snow.bufs.id, sizeof(char));
+	_snow_arr_init(&_snow.bufs.list, sizeof(char));
+	_snow_arr_init(&_snow.print.files, sizeof(FILE *));
+	_snow_arr_init(&_snow.print.fds, sizeof(int));
+	_snow_arr_init(&_snow.profile.cases, sizeof(struct _snow_profile_case));
+	_snow_arr_init(&_snow.profile.stacks, sizeof(struct _snow_profile_stack));
+	_snow_arr_init(&_snow.symbols.syms, sizeof(struct _snow_sym));
 	_snow.current_desc = NULL;
 
 	_snow_opt_bool(_SNOW_OPT_VERSION,      "version",      'v');
@@ -572,17 +4797,60 @@ static void _snow_init(void) {
 	_snow_opt_bool(_SNOW_OPT_TIMER,        "timer",        't');
 	_snow_opt_bool(_SNOW_OPT_RERUN_FAILED, "rerun-failed", '\0');
 	_snow_opt_bool(_SNOW_OPT_GDB,          "gdb",          'g');
-
-	_snow_opt_str(_SNOW_OPT_LOG, "log", 'l', "-");
+	_snow_opt_bool(_SNOW_OPT_ASSERT_STATS, "assert-stats", '\0');
+	_snow_opt_bool(_SNOW_OPT_UPDATE_GOLDEN, "update-golden", '\0');
+	_snow_opt_bool(_SNOW_OPT_WATCH,        "watch",        '\0');
+	_snow_opt_bool(_SNOW_OPT_FORK_CASES,   "fork-cases",   '\0');
+	_snow_opt_bool(_SNOW_OPT_BUDGET_WARN,  "budget-warn",  '\0');
+	_snow_opt_bool(_SNOW_OPT_BENCH_ENV,    "bench-env",    '\0');
+	_snow_opt_bool(_SNOW_OPT_PROGRESS,     "progress",     '\0');
+	_snow_opt_bool(_SNOW_OPT_TEE,          "tee",          '\0');
+	_snow_opt_bool(_SNOW_OPT_ASYNC_LOG,    "async-log",    '\0');
+	_snow_opt_bool(_SNOW_OPT_IO_STATS,     "io-stats",     '\0');
+	_snow_opt_bool(_SNOW_OPT_KEEP_TMP,     "keep-tmp",     '\0');
+
+	_snow_opt_list(_SNOW_OPT_LOG, "log", 'l');
+	_snow_opt_str(_SNOW_OPT_CACHE, "cache", '\0', NULL);
+	_snow_opt_str(_SNOW_OPT_SLOWEST, "slowest", '\0', NULL);
+	_snow_opt_str(_SNOW_OPT_MAX_CASE_TIME, "max-case-time", '\0', NULL);
+	_snow_opt_str(_SNOW_OPT_BENCH_CPU, "bench-cpu", '\0', NULL);
+	_snow_opt_str(_SNOW_OPT_TRACE, "trace", '\0', NULL);
+	_snow_opt_str(_SNOW_OPT_PROFILE, "profile", '\0', NULL);
+	_snow_opt_str(_SNOW_OPT_FORMAT, "format", '\0', "text");
+	_snow_opt_str(_SNOW_OPT_RUN_ID, "run-id", '\0', NULL);
+	_snow_opt_str(_SNOW_OPT_TMP_DIR, "tmp-dir", '\0', NULL);
+	_snow_opt_list(_SNOW_OPT_WATCH_FILE, "watch-file", '\0');
 
 	_snow.print.file = stdout;
 }
 
+/*
+ * Check whether a describe pattern from the command line matches the
+ * full name of a desc.
+ */
+__attribute__((unused))
+static int _snow_desc_matches(const char *pattern, const char *full_name) {
+	// Use fnmatch to do glob matching if that's enabled,
+	// otherwise just compare with strcmp
+#if SNOW_USE_FNMATCH != 0
+	int fm = fnmatch(pattern, full_name, 0);
+	if (fm != 0 && fm != FNM_NOMATCH) {
+		fprintf(stderr, "Pattern error: %s\n", pattern);
+		exit(EXIT_FAILURE);
+	}
+	return fm == 0;
+#else
+	return strcmp(pattern, full_name) == 0;
+#endif
+}
+
 __attribute__((unused))
 static void _snow_desc_begin(const char *name) {
 	struct _snow_desc desc = { 0 };
 	desc.name = name;
 	desc.start_time = _snow_now();
+	_snow_arr_init(&desc.fixtures, sizeof(struct _snow_fixture *));
+	_snow_arr_init(&desc.case_names, sizeof(const char *));
 
 	struct _snow_desc *parent_desc = NULL;
 	if (_snow.desc_stack.length > 0)
@@ -591,11 +4859,11 @@ static void _snow_desc_begin(const char *name) {
 	// Create the full name
 	if (parent_desc == NULL) {
 		desc.full_name_len = strlen(name);
-		desc.full_name = malloc(desc.full_name_len + 1);
+		desc.full_name = _snow_malloc(desc.full_name_len + 1);
 		strcpy(desc.full_name, name);
 	} else {
 		desc.full_name_len = strlen(name) + parent_desc->full_name_len + 1;
-		desc.full_name = malloc(desc.full_name_len + 2);
+		desc.full_name = _snow_malloc(desc.full_name_len + 2);
 		strcpy(desc.full_name, parent_desc->full_name);
 		strcpy(desc.full_name + parent_desc->full_name_len, ".");
 		strcpy(desc.full_name + parent_desc->full_name_len + 1, name);
@@ -605,8 +4873,12 @@ static void _snow_desc_begin(const char *name) {
 		desc.has_after_jmp = parent_desc->has_after_jmp;
 		if (desc.has_after_jmp)
 			memcpy(desc.after_jmp, parent_desc->after_jmp, sizeof(parent_desc->after_jmp));
+		desc.cache_inputs = parent_desc->cache_inputs;
 	}
 
+	if (parent_desc == NULL)
+		_snow_desc_declared_fixtures(&desc);
+
 	// Check if desc is enabled
 	if (_snow.desc_patterns.length == 0) {
 		desc.enabled = 1;
@@ -617,25 +4889,9 @@ static void _snow_desc_begin(const char *name) {
 
 		for (size_t i = 0; i < _snow.desc_patterns.length; ++i) {
 			char *pattern = *(char **)_snow_arr_get(&_snow.desc_patterns, i);
-			int matched = 0;
-			int error = 0;
-
-			// Use fnmatch to do glob matching if that's enabled,
-			// otherwise just compare with strcmp
-#if SNOW_USE_FNMATCH != 0
-			int fm = fnmatch(pattern, desc.full_name, 0);
-			matched = fm == 0;
-			error = !matched && fm != FNM_NOMATCH;
-#else
-			matched = strcmp(pattern, desc.full_name) == 0;
-#endif
-
-			if (matched) {
+			if (_snow_desc_matches(pattern, desc.full_name)) {
 				desc.enabled = 1;
 				break;
-			} else if (error) {
-				fprintf(stderr, "Pattern error: %s\n", pattern);
-				exit(EXIT_FAILURE);
 			}
 		}
 	}
@@ -644,8 +4900,13 @@ static void _snow_desc_begin(const char *name) {
 
 	_snow.current_desc =
 		(struct _snow_desc *)_snow_arr_top(&_snow.desc_stack);
+	_snow_times_desc_begin();
+	if (desc.enabled && _snow_tracing())
+		_snow_trace_event('B',
+			_snow.desc_stack.length == 1 ? "describe" : "subdesc",
+			_snow.current_desc->full_name);
 
-	if (desc.enabled && _snow.opts[_SNOW_OPT_LIST].boolval) {
+	if (desc.enabled && _snow.opts[_SNOW_OPT_LIST].boolval && !_snow_list_json()) {
 		char *spaces = _snow_spaces(_snow.desc_stack.length - 1);
 		_snow_print("%s%s\n", spaces, _snow.current_desc->full_name);
 		return;
@@ -654,8 +4915,15 @@ static void _snow_desc_begin(const char *name) {
 
 __attribute__((unused))
 static void _snow_desc_end(void) {
-	if (_snow.current_desc->printed && !_snow.opts[_SNOW_OPT_LIST].boolval)
+	int ran =
+		_snow.current_desc->printed ||
+		(_snow.opts[_SNOW_OPT_PROGRESS].boolval &&
+			_snow.current_desc->num_tests > 0);
+	if (ran && !_snow.opts[_SNOW_OPT_LIST].boolval)
 		_snow_print_desc_end();
+	_snow_times_desc_end();
+	if (_snow.current_desc->enabled && _snow_tracing())
+		_snow_trace_event('E', NULL, NULL);
 
 	struct _snow_desc *desc =
 		(struct _snow_desc *)_snow_arr_pop(&_snow.desc_stack);
@@ -670,71 +4938,301 @@ static void _snow_desc_end(void) {
 		_snow.current_desc = NULL;
 	}
 
-	free(desc->full_name);
+	_snow_free(desc->full_name);
+	_snow_arr_reset(&desc->fixtures);
+	_snow_arr_reset(&desc->case_names);
+}
+
+/*
+ * Check whether a top-level describe might have test cases that run.
+ * A pattern like "a.b" enables only a subdesc, so the part before the
+ * first dot is matched too. Guessing wrong only costs a fixture being
+ * set up again, since fixtures are set up lazily.
+ */
+__attribute__((unused))
+static int _snow_desc_func_enabled(const char *name) {
+	if (_snow.desc_patterns.length == 0)
+		return 1;
+
+	for (size_t i = 0; i < _snow.desc_patterns.length; ++i) {
+		char *pattern = *(char **)_snow_arr_get(&_snow.desc_patterns, i);
+		if (_snow_desc_matches(pattern, name))
+			return 1;
+
+		char *dot = strchr(pattern, '.');
+		if (dot == NULL)
+			continue;
+
+		*dot = '\0';
+		int matched = _snow_desc_matches(pattern, name);
+		*dot = '.';
+		if (matched)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Find the last enabled describe which uses each fixture, according
+ * to snow_use_fixture_in. Called once the describes are in the order
+ * they'll run in.
+ */
+__attribute__((unused))
+static void _snow_fixtures_plan(void) {
+	for (size_t i = 0; i < _snow.fixture_uses.length; ++i) {
+		struct _snow_fixture_use *use = _snow_arr_get(&_snow.fixture_uses, i);
+		struct _snow_fixture *fixture = _snow_fixture_find(use->fixture);
+
+		int found = 0;
+		for (size_t j = 0; j < _snow.desc_funcs.length; ++j) {
+			struct _snow_desc_func *df = _snow_arr_get(&_snow.desc_funcs, j);
+			if (strcmp(df->name, use->desc) != 0)
+				continue;
+
+			found = 1;
+			if (_snow_desc_func_enabled(df->name) && j + 1 > fixture->last_desc)
+				fixture->last_desc = j + 1;
+		}
+
+		if (!found) {
+			fprintf(stderr, "Unknown describe: %s\n", use->desc);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/*
+ * Called after the describe at 'index' in _snow.desc_funcs is done,
+ * to tear down the fixtures no later describe uses.
+ */
+__attribute__((unused))
+static void _snow_fixtures_desc_done(size_t index) {
+	for (size_t i = 0; i < _snow.fixtures.length; ++i) {
+		struct _snow_fixture *fixture = _snow_arr_get(&_snow.fixtures, i);
+		if (fixture->last_desc == index + 1)
+			_snow_fixture_teardown(fixture);
+	}
 }
 
 /*
  * Begin a test case. It has to be a macro, not a function, because
  * longjmp can't jump to setjmps from a function call which has returned.
  */
-#define _snow_case_begin(casename) \
+#define _snow_case_begin(caseopts) \
 	do { \
-		if (_snow.opts[_SNOW_OPT_LIST].boolval) break; \
 		if (!_snow.current_desc->enabled) break; \
+		_snow.current_case.opts = caseopts; \
+		_snow.current_case.name = _snow.current_case.opts.name; \
+		_snow.current_case.filename = __FILE__; \
+		_snow.current_case.linenum = __LINE__; \
+		if (_snow.opts[_SNOW_OPT_LIST].boolval) { _snow_case_list(); break; } \
+		if (!_snow_case_selected()) break; \
+		if (!_snow_case_claimed()) break; \
 		if (!_snow.current_desc->printed) _snow_print_desc_begin(); \
+		if (_snow_case_cached()) break; \
+		_snow_case_fixtures(); \
+		_snow_trace_event('B', "case", _snow.current_case.name); \
+		_snow.trace.case_depth = _snow.trace.depth; \
 		_snow.in_case = 1; \
 		_snow.current_case.success = 0; \
-		_snow.current_case.name = casename; \
-		_snow.current_case.start_time = _snow_now(); \
+		_snow.current_case.before_all_failed = 0; \
+		_snow.current_case.num_asserts = 0; \
+		_snow.current_case.thread_asserts = 0; \
+		_snow.current_case.thread_fail.failed = 0; \
+		_snow.current_case.sanitizer.errors = 0; \
+		_snow.current_case.sanitizer.ready = 0; \
+		_snow.current_case.stress.threads = 0; \
+		_snow_arr_reset(&_snow.current_case.sweep.points); \
+		_snow.current_case.over_budget = 0; \
+		_snow.current_case.tmpdir[0] = '\0'; \
 		_snow_arr_reset(&_snow.current_case.defers); \
 		_snow_print_case_begin(); \
 		_snow.current_desc->num_tests += 1; \
-		if (_snow.current_desc->has_before_jmp) { \
+		/* Run the before_alls which haven't run yet. If one fails, */ \
+		/* _snow_case_end jumps back here with 2 */ \
+		while ((_snow.current_case.before_all = _snow_case_before_all()) != NULL) { \
+			switch (setjmp(_snow.current_case.before_jmp_ret)) { \
+			case 0: \
+				_snow.in_before_all = 1; \
+				_snow_trace_event('B', "hook", "before_all"); \
+				longjmp(_snow.current_case.before_all->before_all_jmp, 1); \
+			case 2: \
+				_snow.current_case.before_all->before_all_failed = 1; \
+				_snow.current_case.before_all_failed = 1; \
+			} \
+			_snow_trace_event('E', NULL, NULL); \
+			_snow.in_before_all = 0; \
+		} \
+		if (_snow_case_before_all_failed()) break; \
+		_snow.current_case.start_time = _snow_now(); \
+		_snow_bench_case_begin(); \
+		_snow_allocs_start(); \
+		_snow_vtime_start(); \
+		if (_snow.opts[_SNOW_OPT_FORK_CASES].boolval) _snow_case_fork(); \
+		if (_snow.in_case && _snow.current_desc->has_before_jmp) { \
 			if (setjmp(_snow.current_case.before_jmp_ret) == 0) { \
 				_snow.in_before_each = 1; \
+				_snow_trace_event('B', "hook", "before_each"); \
 				longjmp(_snow.current_desc->before_jmp, 1); \
 			} \
+			_snow_trace_event('E', NULL, NULL); \
 			_snow.in_before_each = 0; \
 		} \
 		/* Set jump point which _snow_case_end */ \
 		/* (and each defer) will jump back to */ \
 		if (setjmp(_snow.current_case.done_jmp_ret) == 1) { \
+			_snow_trace_unwind(); \
 			while (_snow.current_case.defers.length > 0) { \
 				if (setjmp(_snow.current_case.defer_jmp_ret) == 0) { \
 					jmp_buf *jmp = (jmp_buf *)_snow_arr_pop(&_snow.current_case.defers); \
+					_snow_trace_event('B', "defer", "defer"); \
 					longjmp(*jmp, 1); \
 				} \
+				_snow_trace_unwind(); \
 			} \
 			/* Run after_each */ \
 			if (_snow.current_desc->has_after_jmp) { \
 				if (setjmp(_snow.current_case.after_jmp_ret) == 0) { \
 					_snow.in_after_each = 1; \
+					_snow_trace_event('B', "hook", "after_each"); \
 					longjmp(_snow.current_desc->after_jmp, 1); \
 				} \
+				_snow_trace_event('E', NULL, NULL); \
 				_snow.in_after_each = 0; \
 			} \
+			_snow_vtime_stop(); \
+			_snow_case_check_budget(); \
+			_snow_case_check_leaks(); \
+			_snow_case_deferred_pass(); \
+			_snow_case_tmpdir_end(); \
 			/* Either re-run or just go back */ \
 			int should_rerun = _snow.opts[_SNOW_OPT_RERUN_FAILED].boolval && \
 				!_snow.rerunning_case && !_snow.current_case.success; \
 			if (should_rerun) { \
 				/* Run before_each again */ \
+				_snow_vtime_start(); \
 				if (_snow.current_desc->has_before_jmp) { \
 					if (setjmp(_snow.current_case.before_jmp_ret) == 0) { \
 						_snow.in_before_each = 1; \
+						_snow_trace_event('B', "hook", "before_each"); \
 						longjmp(_snow.current_desc->before_jmp, 1); \
 					} \
+					_snow_trace_event('E', NULL, NULL); \
 					_snow.in_before_each = 0; \
 				} \
 				/* Actually re-run */ \
+				_snow_io_start(); \
 				_snow.rerunning_case = 1; \
 				longjmp(_snow.current_case.rerun, 1); \
 			} else { \
 				_snow.rerunning_case = 0; \
 				_snow.in_case = 0; \
+				_snow_case_finish(); \
 			} \
+		} else if (_snow.in_case) { \
+			_snow_io_start(); \
+			_snow_profile_start(); \
 		} \
 	} while (0)
 
+/*
+ * Report that a test case passed, along with anything else there is
+ * to say about it.
+ */
+__attribute__((unused))
+static void _snow_case_passed(void) {
+	_snow.current_desc->num_success += 1;
+	_snow_print_case_success();
+	if (_snow.current_case.over_budget > 0)
+		_snow_print_case_over_budget();
+	if (_snow.current_case.sweep.points.length > 0)
+		_snow_print_sweep();
+	if (_snow.current_case.migrations > 0)
+		_snow_print_case_migrated();
+}
+
+/*
+ * Called after a test case's defers and after_each. With SNOW_TRACK_ALLOCS,
+ * a test case which would otherwise have passed fails if it didn't free
+ * everything it allocated.
+ */
+__attribute__((unused))
+static void _snow_case_check_leaks(void) {
+	if (!_snow.allocs.active)
+		return;
+
+	__atomic_store_n(&_snow.allocs.active, 0, __ATOMIC_RELAXED);
+	int leaked = __atomic_load_n(&_snow.allocs.count, __ATOMIC_RELAXED) > 0;
+	if (_snow.rerunning_case) {
+		if (leaked)
+			snow_rerun_failed();
+	} else if (_snow.current_case.success && leaked) {
+		char *spaces = _snow_print_case_failure();
+		_snow_print_leaks(spaces);
+		_snow_print("%s    in %s:%i(%s)\n", spaces,
+			_snow.current_case.filename, _snow.current_case.linenum,
+			_snow.current_desc->full_name);
+		_snow.current_case.success = 0;
+		_snow.exit_code = EXIT_FAILURE;
+	}
+
+	_snow_allocs_reset();
+}
+
+/*
+ * Called after a test case's defers and after_each, which count towards
+ * its time budget along with its before_each and body.
+ */
+__attribute__((unused))
+static void _snow_case_check_budget(void) {
+	if (!_snow.current_case.check_budget)
+		return;
+
+	double budget = _snow_case_budget();
+	double msec = _snow_now() - _snow.current_case.start_time;
+	int warn =
+		_snow.current_case.opts.budget_warn ||
+		_snow.opts[_SNOW_OPT_BUDGET_WARN].boolval;
+	if (msec <= budget)
+		return;
+
+	if (warn) {
+		_snow.current_case.over_budget = msec;
+		return;
+	}
+
+	if (_snow.rerunning_case)
+		snow_rerun_failed();
+	else if (!_snow.current_case.success)
+		return;
+
+	char *spaces = _snow_print_case_failure();
+	_snow_print("%s    Took ", spaces);
+	_snow_print_duration(msec);
+	_snow_print(", but the time budget is ");
+	_snow_print_duration(budget);
+	_snow_print(".\n");
+	_snow_print("%s    in %s:%i(%s)\n", spaces,
+		_snow.current_case.filename, _snow.current_case.linenum,
+		_snow.current_desc->full_name);
+	if (!_snow.rerunning_case) {
+		_snow.current_case.success = 0;
+		_snow.exit_code = EXIT_FAILURE;
+	}
+}
+
+/*
+ * A test case which passed, but had leaks or a time budget to check,
+ * passes once they've been checked.
+ */
+__attribute__((unused))
+static void _snow_case_deferred_pass(void) {
+	if (_snow.current_case.pass_deferred &&
+			_snow.current_case.success && !_snow.rerunning_case)
+		_snow_case_passed();
+}
+
 /*
  * Called after a test case block is done.
  */
@@ -743,53 +5241,459 @@ static void _snow_case_end(int success) {
 	if (!_snow.in_case)
 		return;
 
+	// A before_all failed, which fails every test case it's for
+	if (_snow.in_before_all)
+		longjmp(_snow.current_case.before_jmp_ret, 2);
+
+	_snow_io_stop();
+	_snow_profile_stop();
+
+	// An assertion might have failed in a thread started by the test
+	if (success &&
+			__atomic_load_n(
+				&_snow.current_case.thread_fail.failed, __ATOMIC_ACQUIRE) != 0) {
+		if (_snow.rerunning_case)
+			snow_rerun_failed();
+
+		char *spaces = _snow_print_case_failure();
+		_snow_print("%s    %s\n", spaces, _snow.current_case.thread_fail.msg);
+		_snow_print("%s    in %s:%i(%s), in thread %lu\n", spaces,
+			_snow.current_case.thread_fail.filename,
+			_snow.current_case.thread_fail.linenum,
+			_snow.current_desc->full_name,
+			_snow.current_case.thread_fail.thread_id);
+		success = 0;
+	}
+
+	// A sanitizer might have reported an error without aborting
+	if (success &&
+			__atomic_load_n(
+				&_snow.current_case.sanitizer.errors, __ATOMIC_RELAXED) > 0) {
+		if (_snow.rerunning_case)
+			snow_rerun_failed();
+
+		_snow_print_sanitizer_failure();
+		success = 0;
+	}
+
+	if (_snow.opts[_SNOW_OPT_BENCH_ENV].boolval)
+		_snow_bench_check_cpu();
+
+	// Leaks and the time budget are checked after the defers and after_each,
+	// so passing has to wait until then
+	_snow.current_case.check_budget =
+		success && _snow_case_budget() > 0 &&
+		_snow.opts[_SNOW_OPT_TIMER].boolval;
+	_snow.current_case.pass_deferred =
+		_snow.allocs.active || _snow.current_case.check_budget;
+
 	if (!_snow.rerunning_case) {
 		_snow.current_case.success = success;
-		if (success) {
-			_snow.current_desc->num_success += 1;
-			_snow_print_case_success();
-		} else {
+		if (!success)
 			_snow.exit_code = EXIT_FAILURE;
+		else if (!_snow.current_case.pass_deferred)
+			_snow_case_passed();
+	}
+
+	longjmp(_snow.current_case.done_jmp_ret, 1);
+}
+
+/*
+ * Called by defer, to register a new jmp_buf
+ * on the defer stack.
+ */
+__attribute__((unused))
+static void _snow_case_defer_push(jmp_buf jmp) {
+	_snow_arr_push(&_snow.current_case.defers, jmp);
+}
+
+/*
+ * Called when a defer is done.
+ * Will jump back to _snow_case_begin.
+ */
+__attribute__((unused))
+static void _snow_case_defer_jmp(void) {
+	longjmp(_snow.current_case.defer_jmp_ret, 1);
+}
+
+/*
+ * Called when a before_each is done.
+ * Will jump back to _snow_case_begin.
+ */
+__attribute__((unused))
+static void _snow_before_each_end(void) {
+	longjmp(_snow.current_case.before_jmp_ret, 1);
+}
+
+/*
+ * Called when a after_each is done.
+ * Will jump back to _snow_case_begin.
+ */
+__attribute__((unused))
+static void _snow_after_each_end(void) {
+	longjmp(_snow.current_case.after_jmp_ret, 1);
+}
+
+/*
+ * Called by _snow_case_begin before a test case runs. Marks the descs
+ * containing the test case as having run cases, and returns the outermost
+ * desc with a before_all which hasn't run yet, if any.
+ */
+__attribute__((unused))
+static struct _snow_desc *_snow_case_before_all(void) {
+	for (size_t i = 0; i < _snow.desc_stack.length; ++i) {
+		struct _snow_desc *desc = _snow_arr_get(&_snow.desc_stack, i);
+		if (desc->cases_ran)
+			continue;
+
+		desc->cases_ran = 1;
+		if (desc->has_before_all_jmp)
+			return desc;
+	}
+
+	return NULL;
+}
+
+/*
+ * Called by _snow_case_begin after the before_alls. If the before_all of
+ * the test case's desc or one of its parents failed, the test case fails
+ * without running.
+ */
+__attribute__((unused))
+static int _snow_case_before_all_failed(void) {
+	struct _snow_desc *failed = NULL;
+	for (size_t i = 0; i < _snow.desc_stack.length && failed == NULL; ++i) {
+		struct _snow_desc *desc = _snow_arr_get(&_snow.desc_stack, i);
+		if (desc->before_all_failed)
+			failed = desc;
+	}
+
+	if (failed == NULL)
+		return 0;
+
+	// The test case which ran the before_all already printed why it failed
+	if (!_snow.current_case.before_all_failed) {
+		char *spaces = _snow_print_case_failure();
+		_snow_print("%s    The before_all in %s failed.\n",
+			spaces, failed->full_name);
+	}
+
+	_snow.in_case = 0;
+	_snow.current_case.success = 0;
+	_snow.exit_code = EXIT_FAILURE;
+	_snow_case_finish();
+	return 1;
+}
+
+/*
+ * Called when a before_all is done.
+ * Will jump back to _snow_case_begin.
+ */
+__attribute__((unused))
+static void _snow_before_all_end(void) {
+	longjmp(_snow.current_case.before_jmp_ret, 1);
+}
+
+/*
+ * Called where an after_all is. It only runs if any test cases
+ * in the desc ran.
+ */
+__attribute__((unused))
+static int _snow_after_all_begin(void) {
+	if (!_snow.current_desc->cases_ran)
+		return 0;
+
+	_snow.in_after_all = 1;
+	_snow_trace_event('B', "hook", "after_all");
+	return 1;
+}
+
+__attribute__((unused))
+static void _snow_after_all_end(void) {
+	_snow.in_after_all = 0;
+	_snow_trace_event('E', NULL, NULL);
+}
+
+/*
+ * Stress tests
+ */
+
+typedef void (*snow_stress_func)(void *arg, int thread);
+
+struct _snow_stress_thread {
+	int index;
+	snow_stress_func func;
+	void *arg;
+	unsigned long iterations;
+	unsigned long done;
+	double start_time;
+	double end_time;
+};
+
+/*
+ * Run one stress test thread's iterations. Failing assertions longjmp
+ * to bail_jmp, which ends this thread's iterations early.
+ */
+__attribute__((unused))
+static void _snow_stress_iterate(struct _snow_stress_thread *st) {
+	jmp_buf bail_jmp;
+	volatile unsigned long done = 0;
+	st->start_time = _snow_clock();
+	if (setjmp(bail_jmp) == 0) {
+		_snow_thread.bail_jmp = &bail_jmp;
+		for (; done < st->iterations; ++done)
+			st->func(st->arg, st->index);
+	}
+	_snow_thread.bail_jmp = NULL;
+	st->end_time = _snow_clock();
+	st->done = done;
+}
+
+#if SNOW_USE_PTHREAD != 0
+struct _snow_stress_gate {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int ready;
+	int go;
+};
+
+struct _snow_stress_worker {
+	struct _snow_stress_thread thread;
+	struct _snow_stress_gate *gate;
+};
+
+/*
+ * Each worker waits at the gate until every thread is started,
+ * so that they all begin hammering at the same time.
+ */
+__attribute__((unused))
+static void *_snow_stress_worker(void *ptr) {
+	struct _snow_stress_worker *worker = ptr;
+	struct _snow_stress_gate *gate = worker->gate;
+	_snow_bench_unpin();
+
+	pthread_mutex_lock(&gate->mutex);
+	gate->ready += 1;
+	pthread_cond_broadcast(&gate->cond);
+	while (!gate->go)
+		pthread_cond_wait(&gate->cond, &gate->mutex);
+	int go = gate->go;
+	pthread_mutex_unlock(&gate->mutex);
+
+	if (go > 0)
+		_snow_stress_iterate(&worker->thread);
+	return NULL;
+}
+#endif
+
+/*
+ * Run 'func' 'iterations' times on each of 'threads' threads,
+ * and record the numbers which _snow_print_stress prints.
+ * Returns 1 if the stress test's block should run.
+ */
+__attribute__((unused))
+static int _snow_stress_run(
+		int threads, unsigned long iterations,
+		snow_stress_func func, void *arg) {
+	if (threads < 1)
+		threads = 1;
+
+	struct _snow_stress_thread *sts = _snow_calloc(threads, sizeof(*sts));
+	for (int i = 0; i < threads; ++i) {
+		sts[i].index = i;
+		sts[i].func = func;
+		sts[i].arg = arg;
+		sts[i].iterations = iterations;
+	}
+
+	double start_time;
+	int num_started = threads;
+
+#if SNOW_USE_PTHREAD != 0
+	struct _snow_stress_gate gate;
+	pthread_mutex_init(&gate.mutex, NULL);
+	pthread_cond_init(&gate.cond, NULL);
+	gate.ready = 0;
+	gate.go = 0;
+
+	pthread_t *tids = _snow_malloc(threads * sizeof(*tids));
+	struct _snow_stress_worker *workers = _snow_malloc(threads * sizeof(*workers));
+	for (int i = 0; i < threads; ++i) {
+		workers[i].gate = &gate;
+		workers[i].thread = sts[i];
+		if (pthread_create(&tids[i], NULL, _snow_stress_worker, &workers[i]) != 0) {
+			num_started = i;
+			break;
 		}
 	}
 
-	longjmp(_snow.current_case.done_jmp_ret, 1);
+	pthread_mutex_lock(&gate.mutex);
+	while (gate.ready < num_started)
+		pthread_cond_wait(&gate.cond, &gate.mutex);
+	start_time = _snow_clock();
+	gate.go = num_started == threads ? 1 : -1;
+	pthread_cond_broadcast(&gate.cond);
+	pthread_mutex_unlock(&gate.mutex);
+
+	for (int i = 0; i < num_started; ++i) {
+		pthread_join(tids[i], NULL);
+		sts[i] = workers[i].thread;
+	}
+
+	pthread_mutex_destroy(&gate.mutex);
+	pthread_cond_destroy(&gate.cond);
+	_snow_free(tids);
+	_snow_free(workers);
+#else
+	// Without threads, the best we can do is to run each
+	// "thread" after each other. A failing assertion bails out of
+	// the iterations like it would in a worker thread, instead of
+	// longjmping out of here and leaking 'sts'.
+	start_time = _snow_clock();
+	_snow_thread.is_case_thread = 0;
+	for (int i = 0; i < threads; ++i)
+		_snow_stress_iterate(&sts[i]);
+	_snow_thread.is_case_thread = 1;
+#endif
+
+	if (num_started != threads) {
+		_snow_free(sts);
+		snow_fail_update();
+		snow_fail("Failed to start stress test thread %i of %i.",
+			num_started + 1, threads);
+	}
+
+	// Total throughput, and Jain's fairness index and the slowest/fastest
+	// ratio of the threads' individual throughputs
+	double end_time = start_time;
+	double sum = 0, sum_sq = 0, min_rate = 0, max_rate = 0;
+	unsigned long ops = 0;
+	for (int i = 0; i < threads; ++i) {
+		ops += sts[i].done;
+		if (sts[i].end_time > end_time)
+			end_time = sts[i].end_time;
+
+		double msec = sts[i].end_time - sts[i].start_time;
+		double rate = msec > 0 ? sts[i].done / msec : 0;
+		sum += rate;
+		sum_sq += rate * rate;
+		if (i == 0 || rate < min_rate) min_rate = rate;
+		if (i == 0 || rate > max_rate) max_rate = rate;
+	}
+
+	_snow.current_case.stress.threads = threads;
+	_snow.current_case.stress.ops = ops;
+	_snow.current_case.stress.msec = end_time - start_time;
+	_snow.current_case.stress.fairness =
+		sum_sq > 0 ? (sum * sum) / (threads * sum_sq) : 1;
+	_snow.current_case.stress.spread =
+		min_rate > 0 ? max_rate / min_rate : 1;
+
+	_snow_free(sts);
+	return __atomic_load_n(
+		&_snow.current_case.thread_fail.failed, __ATOMIC_ACQUIRE) == 0;
 }
 
 /*
- * Called by defer, to register a new jmp_buf
- * on the defer stack.
+ * Sweeps
  */
-__attribute__((unused))
-static void _snow_case_defer_push(jmp_buf jmp) {
-	_snow_arr_push(&_snow.current_case.defers, jmp);
-}
+
+// Each size is timed this many times, and the fastest time is used
+#define _SNOW_SWEEP_ROUNDS 3
 
 /*
- * Called when a defer is done.
- * Will jump back to _snow_case_begin.
+ * How many repetitions it takes for one round of a size to run for its
+ * share of SNOW_SWEEP_MIN_MSEC, if each repetition takes 'per_rep' msec.
  */
 __attribute__((unused))
-static void _snow_case_defer_jmp(void) {
-	longjmp(_snow.current_case.defer_jmp_ret, 1);
+static unsigned long _snow_sweep_reps(double per_rep) {
+	double target = (double)SNOW_SWEEP_MIN_MSEC / _SNOW_SWEEP_ROUNDS;
+	if (per_rep <= 0)
+		return _snow.current_case.sweep.reps * 8;
+
+	double reps = target / per_rep;
+	if (reps < 1)
+		return 1;
+	if (reps > ULONG_MAX / 16)
+		return ULONG_MAX / 16;
+	return (unsigned long)reps;
 }
 
 /*
- * Called when a before_each is done.
- * Will jump back to _snow_case_begin.
+ * Called by snow_sweep before its first iteration.
  */
 __attribute__((unused))
-static void _snow_before_each_end(void) {
-	longjmp(_snow.current_case.before_jmp_ret, 1);
+static void _snow_sweep_begin(size_t lo, size_t hi) {
+	_snow.current_case.sweep.n = lo > 0 ? lo : 1;
+	_snow.current_case.sweep.hi = hi;
+	_snow.current_case.sweep.reps = 1;
+	_snow.current_case.sweep.rep = 0;
+	_snow.current_case.sweep.round = 0;
+	_snow.current_case.sweep.start_time = _snow_clock();
 }
 
 /*
- * Called when a after_each is done.
- * Will jump back to _snow_case_begin.
+ * Called by snow_sweep before each iteration. Each size is run in
+ * _SNOW_SWEEP_ROUNDS rounds of repetitions, and the fastest time per
+ * repetition is recorded, since noise only ever makes things slower.
+ * The number of repetitions comes from the time per repetition measured
+ * so far, so that each size takes about SNOW_SWEEP_MIN_MSEC.
+ * Returns 0 when all sizes are done.
  */
 __attribute__((unused))
-static void _snow_after_each_end(void) {
-	longjmp(_snow.current_case.after_jmp_ret, 1);
+static int _snow_sweep_next(void) {
+	struct _snow_arr *points = &_snow.current_case.sweep.points;
+	if (_snow.current_case.sweep.rep < _snow.current_case.sweep.reps) {
+		_snow.current_case.sweep.rep += 1;
+		return 1;
+	}
+
+	double msec = _snow_clock() - _snow.current_case.sweep.start_time;
+	double per_rep = msec / _snow.current_case.sweep.reps;
+	double target = (double)SNOW_SWEEP_MIN_MSEC / _SNOW_SWEEP_ROUNDS;
+	if (msec < target / 2 &&
+			_snow.current_case.sweep.reps < ULONG_MAX / 16) {
+		// Too short to time well, so try again with a better guess
+		_snow.current_case.sweep.reps = _snow_sweep_reps(per_rep);
+	} else if (++_snow.current_case.sweep.round < _SNOW_SWEEP_ROUNDS) {
+		if (_snow.current_case.sweep.round == 1 ||
+				per_rep < _snow.current_case.sweep.best)
+			_snow.current_case.sweep.best = per_rep;
+	} else {
+		if (per_rep < _snow.current_case.sweep.best)
+			_snow.current_case.sweep.best = per_rep;
+		if (_snow.opts[_SNOW_OPT_BENCH_ENV].boolval)
+			_snow_bench_check_cpu();
+
+		// Guess the next size's time from how much the last doubling cost,
+		// somewhere between O(1) and O(n^3)
+		double growth = 2;
+		if (points->length > 0) {
+			struct _snow_sweep_point *prev = _snow_arr_top(points);
+			if (prev->msec > 0)
+				growth = _snow.current_case.sweep.best / prev->msec;
+			growth = growth < 1 ? 1 : growth > 8 ? 8 : growth;
+		}
+
+		struct _snow_sweep_point point = {
+			_snow.current_case.sweep.n,
+			_snow.current_case.sweep.best,
+		};
+		_snow_arr_push(points, &point);
+
+		if (_snow.current_case.sweep.n >= _snow.current_case.sweep.hi ||
+				_snow.current_case.sweep.n > SIZE_MAX / 2)
+			return 0;
+
+		_snow.current_case.sweep.n *= 2;
+		_snow.current_case.sweep.round = 0;
+		_snow.current_case.sweep.reps =
+			_snow_sweep_reps(point.msec * growth);
+	}
+
+	_snow.current_case.sweep.rep = 1;
+	_snow.current_case.sweep.start_time = _snow_clock();
+	return 1;
 }
 
 /*
@@ -814,7 +5718,29 @@ static void _snow_usage(char *argv0) {
 		"                    Default: off.\n"
 		"    --no-quiet:     Force disable --quiet.\n"
 		"\n"
-		"    --log <file>:   Log output to a file, rather than stdout.\n"
+		"    --log <file>:   Log output to a file, rather than stdout. May be\n"
+		"                    passed multiple times to log to multiple files.\n"
+		"\n"
+		"    --tee:          Print to stdout as well as to the --log files.\n"
+		"                    Default: off.\n"
+		"\n"
+		"    --async-log:    Print through an in-memory buffer, which a background\n"
+		"                    thread writes to stdout and the log files.\n"
+		"                    Default: off.\n"
+		"\n"
+		"    --trace <file>: Write a timeline of the describes, test cases, hooks\n"
+		"                    and defers to <file>, in the Chrome trace format.\n"
+		"\n"
+		"    --profile <file>: Sample the stacks of test cases as they run,\n"
+		"                    and write them to <file> as folded stacks.\n"
+		"\n"
+		"    --format <fmt>: What --list prints. 'text' lists the describes,\n"
+		"                    'json' lists every test case with its ID, tags\n"
+		"                    and source location, as a JSON array.\n"
+		"                    Default: text.\n"
+		"\n"
+		"    --run-id <id>:  Run only the test case with the ID <id>, as listed\n"
+		"                    by --list --format=json.\n"
 		"\n"
 		"    --timer|-t:     Display the time taken for by each test after\n"
 		"                    it is completed.\n"
@@ -838,6 +5764,67 @@ static void _snow_usage(char *argv0) {
 		"\n"
 		"    --gdb, -g:      Run the test suite on GDB, and break and re-run\n"
 		"                    test cases which fail.\n"
+		"                    Default: off.\n"
+		"\n"
+		"    --assert-stats: Print the number of assertions executed and the\n"
+		"                    number of assertions per second for each test\n"
+		"                    and for the whole run.\n"
+		"                    Default: off.\n"
+		"\n"
+		"    --io-stats:     Print the number of read and write syscalls each test\n"
+		"                    made, and how many bytes they read and wrote.\n"
+		"                    Needs Linux.\n"
+		"                    Default: off.\n"
+		"\n"
+		"    --tmp-dir <dir>: Where snow_tmpdir creates directories.\n"
+		"                    Default: /dev/shm if it exists, otherwise $TMPDIR\n"
+		"                    or /tmp.\n"
+		"\n"
+		"    --keep-tmp:     Don't remove the directories created by snow_tmpdir,\n"
+		"                    even when the test passes.\n"
+		"                    Default: off.\n"
+		"\n"
+		"    --update-golden: Make golden file assertions write the golden\n"
+		"                    files instead of comparing against them.\n"
+		"                    Default: off.\n"
+		"\n"
+		"    --cache <dir>:  Record passing tests in <dir>, and skip tests which\n"
+		"                    already passed with the same test binary and inputs.\n"
+		"\n"
+		"    --watch:        Run the tests again whenever the test binary or a\n"
+		"                    file passed with --watch-file changes. Describes\n"
+		"                    with failing tests are run first.\n"
+		"                    Default: off.\n"
+		"\n"
+		"    --watch-file <file>: Also re-run when <file> changes. May be passed\n"
+		"                    multiple times.\n"
+		"\n"
+		"    --fork-cases:   Run each test case in a forked process. Each\n"
+		"                    case starts from a copy of the state set up by\n"
+		"                    its describes, before_alls and fixtures.\n"
+		"                    Default: off.\n"
+		"\n"
+		"    --slowest <n>:  Print the <n> slowest tests, a histogram of test\n"
+		"                    durations and the time spent in each describe.\n"
+		"\n"
+		"    --max-case-time <ms>: Fail tests which take longer than <ms>\n"
+		"                    milliseconds, unless they have their own budget.\n"
+		"\n"
+		"    --budget-warn:  Only warn about tests which go over their time\n"
+		"                    budget instead of failing them.\n"
+		"                    Default: off.\n"
+		"\n"
+		"    --bench-env:    Pin the tests to one CPU, raise their priority,\n"
+		"                    warn about CPU frequency scaling and CPU migrations,\n"
+		"                    and print a description of the machine.\n"
+		"                    Default: off.\n"
+		"\n"
+		"    --bench-cpu <cpu>: The CPU to pin to with --bench-env.\n"
+		"                    Default: the CPU snow starts on.\n"
+		"\n"
+		"    --progress:     Only print failures and describe summaries, and\n"
+		"                    show the progress on a single status line when the\n"
+		"                    output is a TTY.\n"
 		"                    Default: off.\n");
     char *default_args[] = { "snow", SNOW_DEFAULT_ARGS };
     if (sizeof(default_args) > sizeof(char *) * 1) {
@@ -872,14 +5859,26 @@ static int _snow_parse_args(char **args, int num) {
 		int inverted = is_long && strncmp(name, "no-", 3) == 0;
 		if (inverted) name += 3;
 
+		// Long options can be given a value as --name=value
+		char *value = is_long ? strchr(name, '=') : NULL;
+		size_t name_len = value != NULL ? (size_t)(value - name) : strlen(name);
+		if (value != NULL)
+			value += 1;
+
 		int is_match = 0;
 		for (int j = 0; j < _SNOW_OPT_LAST; ++j) {
 			struct _snow_opt *opt = _snow.opts + j;
-			is_match = is_long ? strcmp(name, opt->name) == 0 : name[0] == opt->shortname;
+			is_match = is_long ?
+				strncmp(name, opt->name, name_len) == 0 && opt->name[name_len] == '\0' :
+				name[0] == opt->shortname;
 			if (!is_match) continue;
 
 			opt->is_overwritten = 1;
 			if (opt->is_bool) {
+				if (value != NULL) {
+					fprintf(stderr, "%s: No argument expected.\n", arg);
+					return EXIT_FAILURE;
+				}
 				opt->boolval = inverted == 0;
 			} else {
 				if (inverted) {
@@ -887,12 +5886,14 @@ static int _snow_parse_args(char **args, int num) {
 					break;
 				}
 
-				if (i + 1 >= num) {
+				if (value == NULL && i + 1 >= num) {
 					fprintf(stderr, "%s: Argument expected.", arg);
 					return EXIT_FAILURE;
 				}
 
-				opt->strval = args[++i];
+				opt->strval = value != NULL ? value : args[++i];
+				if (opt->is_list)
+					_snow_arr_push(&opt->listval, &opt->strval);
 			}
 
 			break;
@@ -919,6 +5920,9 @@ static int snow_main_function(int argc, char **argv) {
 	if (!_snow_inited)
 		_snow_init();
 
+	// Test cases run on this thread
+	_snow_thread.is_case_thread = 1;
+
 	/*
 	 * Parse arguments
 	 */
@@ -936,19 +5940,29 @@ static int snow_main_function(int argc, char **argv) {
 	 * Respond to args
 	 */
 
-	// Open log file
-	if (strcmp(_snow.opts[_SNOW_OPT_LOG].strval, "-") == 0) {
-		_snow.print.file = stdout;
-	} else {
-		_snow.print.file = fopen(_snow.opts[_SNOW_OPT_LOG].strval, "w");
-		if (_snow.print.file == NULL) {
-			perror(_snow.opts[_SNOW_OPT_LOG].strval);
-			_snow.exit_code = EXIT_FAILURE;
-			goto cleanup;
+	// Open log files. Without --log, or with --tee, we print to stdout too.
+	struct _snow_arr *logs = &_snow.opts[_SNOW_OPT_LOG].listval;
+	FILE *out = stdout;
+	if (logs->length == 0 || _snow.opts[_SNOW_OPT_TEE].boolval)
+		_snow_arr_push(&_snow.print.files, &out);
+	for (size_t i = 0; i < logs->length; ++i) {
+		char *path = *(char **)_snow_arr_get(logs, i);
+		if (strcmp(path, "-") == 0) {
+			if (_snow.print.files.length > 0 &&
+					*(FILE **)_snow_arr_get(&_snow.print.files, 0) == stdout)
+				continue;
+			out = stdout;
 		} else {
-			_snow.print.file_opened = 1;
+			out = fopen(path, "w");
+			if (out == NULL) {
+				perror(path);
+				_snow.exit_code = EXIT_FAILURE;
+				goto cleanup;
+			}
 		}
+		_snow_arr_push(&_snow.print.files, &out);
 	}
+	_snow.print.file = *(FILE **)_snow_arr_get(&_snow.print.files, 0);
 
 	// --help and --version
 	if (_snow.opts[_SNOW_OPT_HELP].boolval) {
@@ -981,6 +5995,115 @@ static int snow_main_function(int argc, char **argv) {
 	_snow_opt_default(_SNOW_OPT_TIMER, 1);
 	_snow_opt_default(_SNOW_OPT_RERUN_FAILED, 0);
 	_snow_opt_default(_SNOW_OPT_GDB, 0);
+	_snow_opt_default(_SNOW_OPT_ASSERT_STATS, 0);
+	_snow_opt_default(_SNOW_OPT_UPDATE_GOLDEN, 0);
+	_snow_opt_default(_SNOW_OPT_WATCH, 0);
+	_snow_opt_default(_SNOW_OPT_FORK_CASES, 0);
+	_snow_opt_default(_SNOW_OPT_BUDGET_WARN, 0);
+	_snow_opt_default(_SNOW_OPT_BENCH_ENV, 0);
+	_snow_opt_default(_SNOW_OPT_PROGRESS, 0);
+	_snow_opt_default(_SNOW_OPT_TEE, 0);
+	_snow_opt_default(_SNOW_OPT_ASYNC_LOG, 0);
+	_snow_opt_default(_SNOW_OPT_IO_STATS, 0);
+	_snow_opt_default(_SNOW_OPT_KEEP_TMP, 0);
+
+	if (_snow.opts[_SNOW_OPT_MAX_CASE_TIME].strval != NULL)
+		_snow.max_case_time = atof(_snow.opts[_SNOW_OPT_MAX_CASE_TIME].strval);
+
+	if (strcmp(_snow.opts[_SNOW_OPT_FORMAT].strval, "text") != 0 && !_snow_list_json()) {
+		fprintf(stderr, "Unknown format: %s\n", _snow.opts[_SNOW_OPT_FORMAT].strval);
+		_snow.exit_code = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if (_snow.opts[_SNOW_OPT_TRACE].strval != NULL &&
+			!_snow.opts[_SNOW_OPT_WATCH].boolval) {
+		char *path = _snow.opts[_SNOW_OPT_TRACE].strval;
+		_snow.trace.file = fopen(path, "w");
+		if (_snow.trace.file == NULL) {
+			perror(path);
+			_snow.exit_code = EXIT_FAILURE;
+			goto cleanup;
+		}
+		fprintf(_snow.trace.file, "[\n");
+	}
+
+	if (_snow.opts[_SNOW_OPT_PROFILE].strval != NULL &&
+			!_snow.opts[_SNOW_OPT_WATCH].boolval &&
+			!_snow.opts[_SNOW_OPT_LIST].boolval) {
+		if (_snow.opts[_SNOW_OPT_FORK_CASES].boolval) {
+			fprintf(stderr, "Can't profile test cases with --fork-cases.\n");
+			_snow.exit_code = EXIT_FAILURE;
+			goto cleanup;
+		}
+		if (_snow_profile_init() < 0) {
+			_snow.exit_code = EXIT_FAILURE;
+			goto cleanup;
+		}
+	}
+
+	_snow_allocs_init();
+	_snow_vtime_init();
+	_snow_sanitizer_init();
+
+	if (_snow.opts[_SNOW_OPT_IO_STATS].boolval &&
+			!_snow.opts[_SNOW_OPT_WATCH].boolval &&
+			_snow_io_open() < 0) {
+		_snow.exit_code = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if (_snow.opts[_SNOW_OPT_ASYNC_LOG].boolval && _snow_log_start() < 0) {
+		fprintf(stderr, "Can't start the --async-log writer thread.\n");
+		_snow.exit_code = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+#if SNOW_USE_FORK == 0
+	if (_snow.opts[_SNOW_OPT_FORK_CASES].boolval) {
+		fprintf(stderr, "Can't fork test cases, because SNOW_USE_FORK is 0.\n");
+		_snow.exit_code = EXIT_FAILURE;
+		goto cleanup;
+	}
+#endif
+
+	// We might be a test run started by --watch
+	if (_snow_watch_init())
+		_snow.opts[_SNOW_OPT_WATCH].boolval = 0;
+
+	// We might be one of the processes started by snow-run
+	if (_snow_run_init() < 0) {
+		_snow.exit_code = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	// If --watch was passed, re-run whenever something changes
+	if (_snow.opts[_SNOW_OPT_WATCH].boolval) {
+#if !defined(__linux__) || SNOW_USE_FORK == 0
+		fprintf(stderr, "Can't watch for changes without inotify and fork.\n");
+		_snow.exit_code = EXIT_FAILURE;
+#else
+		_snow.exit_code = _snow_watch(argc, argv);
+#endif
+		goto cleanup;
+	}
+
+	// Create the cache directory, and find out which binary we are
+	if (_snow.opts[_SNOW_OPT_CACHE].strval != NULL) {
+		char *dir = _snow.opts[_SNOW_OPT_CACHE].strval;
+#ifdef __MINGW32__
+		int err = mkdir(dir);
+#else
+		int err = mkdir(dir, 0777);
+#endif
+		if (err < 0 && errno != EEXIST) {
+			perror(dir);
+			_snow.exit_code = EXIT_FAILURE;
+			goto cleanup;
+		}
+
+		_snow.cache_binary_id = _snow_binary_id(argv[0]);
+	}
 
 	// If --gdb was passed, re-run under GDB
 	if (_snow.opts[_SNOW_OPT_GDB].boolval) {
@@ -1026,7 +6149,7 @@ static int snow_main_function(int argc, char **argv) {
 		size_t stdargc = sizeof(stdargv) / sizeof(*stdargv);
 
 		// Dynamic arguments
-		char **args = malloc(sizeof(*args) * (stdargc + argc) + 1);
+		char **args = _snow_malloc(sizeof(*args) * (stdargc + argc) + 1);
 		size_t idx = 0;
 		for (int i = 0; i < stdargc; ++i) {
 			args[idx++] = stdargv[i];
@@ -1085,6 +6208,27 @@ static int snow_main_function(int argc, char **argv) {
 	 * Run descs
 	 */
 
+	if (_snow.opts[_SNOW_OPT_BENCH_ENV].boolval &&
+			!_snow.opts[_SNOW_OPT_LIST].boolval)
+		_snow_bench_env();
+
+	// With --progress, output is only flushed when the status line is drawn
+	if (_snow.opts[_SNOW_OPT_PROGRESS].boolval) {
+		for (size_t i = 0; i < _snow.print.files.length; ++i)
+			setvbuf(*(FILE **)_snow_arr_get(&_snow.print.files, i),
+				NULL, _IOFBF, 64 * 1024);
+		_snow.progress.is_tty = is_tty;
+		_snow.progress.descs = (int)_snow.desc_funcs.length;
+		_snow.progress.start_time = _snow_clock();
+		_snow.progress.draw_time = _snow.progress.start_time;
+	}
+
+	int list_json = _snow.opts[_SNOW_OPT_LIST].boolval && _snow_list_json();
+	if (list_json)
+		_snow_print("[\n");
+
+	_snow_fixtures_plan();
+
 	double total_start_time = _snow_now();
 	int total_num_tests = 0;
 	int total_num_success = 0;
@@ -1098,11 +6242,46 @@ static int snow_main_function(int argc, char **argv) {
 		total_num_success += _snow.current_desc->num_success;
 		total_descs_ran += !!_snow.current_desc->printed;
 		_snow_desc_end();
+		_snow_fixtures_desc_done(i);
+		_snow.progress.descs_done += 1;
+	}
+
+	if (!_snow.opts[_SNOW_OPT_LIST].boolval)
+		_snow_fixtures_teardown();
+
+	_snow_progress_clear();
+
+	if (list_json)
+		_snow_print("%s]\n", _snow.num_listed > 0 ? "\n" : "");
+
+	if (_snow.opts[_SNOW_OPT_RUN_ID].strval != NULL &&
+			!_snow.opts[_SNOW_OPT_LIST].boolval && !_snow.run_id_found) {
+		fprintf(stderr, "No test case has the ID %s.\n",
+			_snow.opts[_SNOW_OPT_RUN_ID].strval);
+		_snow.exit_code = EXIT_FAILURE;
+	}
+
+	if (_snow.opts[_SNOW_OPT_SLOWEST].strval != NULL &&
+			!_snow.opts[_SNOW_OPT_LIST].boolval) {
+		if (!_snow.opts[_SNOW_OPT_QUIET].boolval)
+			_snow_print("\n");
+		_snow_print_times();
+	}
+
+	if (_snow.profile.enabled) {
+		if (_snow_profile_write(_snow.opts[_SNOW_OPT_PROFILE].strval) < 0)
+			_snow.exit_code = EXIT_FAILURE;
+		if (!_snow.opts[_SNOW_OPT_QUIET].boolval)
+			_snow_print("\n");
+		_snow_print_profile();
 	}
 
 	if (!_snow.opts[_SNOW_OPT_LIST].boolval) {
 		int should_print_total =
 			_snow.opts[_SNOW_OPT_QUIET].boolval ||
+			_snow.opts[_SNOW_OPT_ASSERT_STATS].boolval ||
+			_snow.opts[_SNOW_OPT_CACHE].strval != NULL ||
+			_snow.opts[_SNOW_OPT_PROGRESS].boolval ||
 			total_descs_ran > 1;
 
 		if (!_snow.opts[_SNOW_OPT_QUIET].boolval)
@@ -1122,6 +6301,14 @@ static int snow_main_function(int argc, char **argv) {
 				_snow_print(" ");
 				_snow_print_timer(total_start_time);
 			}
+
+			if (_snow.opts[_SNOW_OPT_ASSERT_STATS].boolval) {
+				_snow_print(" ");
+				_snow_print_asserts(_snow.num_asserts, total_start_time);
+			}
+
+			if (_snow.opts[_SNOW_OPT_CACHE].strval != NULL)
+				_snow_print(" [%i cached]", _snow.num_cached);
 			_snow_print("\n");
 
 			if (!_snow.opts[_SNOW_OPT_QUIET].boolval)
@@ -1134,13 +6321,40 @@ static int snow_main_function(int argc, char **argv) {
 	 */
 
 cleanup:
+	_snow_fixtures_teardown();
+	_snow_arr_reset(&_snow.fixtures);
+	_snow_arr_reset(&_snow.fixture_uses);
+	_snow_run_end();
+	for (size_t i = 0; i < _snow.times.cases.length; ++i)
+		_snow_free(((struct _snow_case_time *)_snow_arr_get(&_snow.times.cases, i))->name);
+	_snow_arr_reset(&_snow.times.cases);
+	_snow_arr_reset(&_snow.times.descs);
 	_snow_arr_reset(&_snow.desc_funcs);
 	_snow_arr_reset(&_snow.desc_stack);
 	_snow_arr_reset(&_snow.desc_patterns);
 	_snow_arr_reset(&_snow.current_case.defers);
+	_snow_arr_reset(&_snow.current_case.sweep.points);
 	_snow_arr_reset(&_snow.bufs.spaces);
-	if (_snow.print.file_opened)
-		fclose(_snow.print.file);
+	_snow_arr_reset(&_snow.bufs.id);
+	_snow_arr_reset(&_snow.bufs.list);
+	for (int i = 0; i < _SNOW_OPT_LAST; ++i) {
+		if (_snow.opts[i].is_list)
+			_snow_arr_reset(&_snow.opts[i].listval);
+	}
+	_snow_profile_cleanup();
+	_snow_allocs_cleanup();
+	_snow_io_close();
+	_snow_symbols_cleanup();
+	_snow_trace_close();
+	_snow_log_stop();
+	for (size_t i = 0; i < _snow.print.files.length; ++i) {
+		FILE *f = *(FILE **)_snow_arr_get(&_snow.print.files, i);
+		if (f != stdout)
+			fclose(f);
+	}
+	_snow_arr_reset(&_snow.print.files);
+	_snow_arr_reset(&_snow.print.fds);
+	_snow.print.file = stdout;
 
 	return _snow.exit_code;
 }
@@ -1149,6 +6363,25 @@ cleanup:
  * Interface
  */
 
+/*
+ * Describe bodies are compiled without optimizations by default, because
+ * the setjmp/longjmp based control flow makes the values of non-volatile
+ * locals changed by hooks or test cases indeterminate. With
+ * SNOW_OPTIMIZE_BODIES, they're compiled like the rest of the program;
+ * snow's own state which crosses a longjmp is all in _snow, or in jmp_bufs
+ * which are copied there, so only the test's locals have to be volatile.
+ * The macros' loop counters are set and read without a longjmp in between.
+ * Keep it that way: a local which a hook or test case jumps back to may
+ * share its stack slot with the hook's locals.
+ */
+#ifdef SNOW_OPTIMIZE_BODIES
+#define _SNOW_DESC_ATTRS
+#else
+#define _SNOW_DESC_ATTRS \
+	__attribute__((optnone)) \
+	__attribute__((optimize(0)))
+#endif
+
 #define describe(name) \
 	static void snow_test_##name(); \
 	__attribute__((constructor (__COUNTER__ + 101))) \
@@ -1157,8 +6390,7 @@ cleanup:
 		struct _snow_desc_func df = { #name, &snow_test_##name }; \
 		_snow_arr_push(&_snow.desc_funcs, &df); \
 	} \
-	__attribute__((optnone)) \
-	__attribute__((optimize(0))) \
+	_SNOW_DESC_ATTRS \
 	static void snow_test_##name()
 
 #define subdesc(name) \
@@ -1166,8 +6398,8 @@ cleanup:
 	for (int _snow_desc_done = 0; _snow_desc_done == 0; \
 			(_snow_desc_done = 1, _snow_desc_end()))
 
-#define it(name) \
-	_snow_case_begin(name); \
+#define it(...) \
+	_snow_case_begin(((struct _snow_case_opts){ __VA_ARGS__ })); \
 	if (_snow.opts[_SNOW_OPT_RERUN_FAILED].boolval) { \
 		if (setjmp(_snow.current_case.rerun) == 1) { \
 			snow_break(); \
@@ -1176,6 +6408,16 @@ cleanup:
 	for (; _snow.in_case; _snow_case_end(1))
 #define test it
 
+#define stress(name, threads, iterations, func, arg) \
+	it(name) \
+	for (int _snow_stress_done = \
+				!_snow_stress_run(threads, iterations, func, arg); \
+			!_snow_stress_done; _snow_stress_done = 1)
+
+#define snow_sweep(var, lo, hi) \
+	for (_snow_sweep_begin((lo), (hi)); \
+			_snow_sweep_next() && ((var) = _snow.current_case.sweep.n, 1); )
+
 #define defer(...) \
 	do { \
 		jmp_buf _snow_jmp; \
@@ -1195,6 +6437,21 @@ cleanup:
 			_snow_before_each_done == 0 && _snow.in_before_each; \
 			(_snow_before_each_done = 1, _snow_before_each_end()))
 
+#define before_all() \
+	_snow.current_desc->has_before_all_jmp = 1; \
+	setjmp(_snow.current_desc->before_all_jmp); \
+	for ( \
+			int _snow_before_all_done = 0; \
+			_snow_before_all_done == 0 && _snow.in_before_all; \
+			(_snow_before_all_done = 1, _snow_before_all_end()))
+
+#define after_all() \
+	if (_snow_after_all_begin()) \
+		for ( \
+				int _snow_after_all_done = 0; \
+				_snow_after_all_done == 0; \
+				(_snow_after_all_done = 1, _snow_after_all_end()))
+
 #define after_each() \
 	_snow.current_desc->has_after_jmp = 1; \
 	setjmp(_snow.current_desc->after_jmp); \
@@ -1203,6 +6460,67 @@ cleanup:
 			_snow_after_each_done == 0 && _snow.in_after_each; \
 			(_snow_after_each_done = 1, _snow_after_each_end()))
 
+#define snow_fixture(name, setup, teardown) \
+	static struct _snow_fixture _snow_fixture_##name; \
+	__attribute__((constructor)) \
+	static void _snow_fixture_constructor_##name() { \
+		if (!_snow_inited) _snow_init(); \
+		_snow_arr_push(&_snow.fixtures, &_snow_fixture_##name); \
+	} \
+	static struct _snow_fixture _snow_fixture_##name = \
+		{ #name, setup, teardown, NULL, 0 }
+
+#define snow_use_fixture(name) \
+	_snow_use_fixture(#name)
+
+#define snow_use_fixture_in(desc, name) \
+	static struct _snow_fixture_use _snow_fixture_use_##desc##_##name; \
+	__attribute__((constructor)) \
+	static void _snow_fixture_use_constructor_##desc##_##name() { \
+		if (!_snow_inited) _snow_init(); \
+		_snow_arr_push(&_snow.fixture_uses, &_snow_fixture_use_##desc##_##name); \
+	} \
+	static struct _snow_fixture_use _snow_fixture_use_##desc##_##name = \
+		{ #desc, #name }
+
+#define snow_fixture_get(name) \
+	_snow_fixture_get(#name)
+
+#define snow_cache_inputs(...) \
+	do { \
+		const char *_snow_paths[] = { __VA_ARGS__ }; \
+		_snow_cache_inputs( \
+			_snow_paths, sizeof(_snow_paths) / sizeof(*_snow_paths)); \
+	} while (0)
+
+#define snow_tmpdir() \
+	_snow_tmpdir(__FILE__, __LINE__)
+
+#define snow_trace_begin(name) \
+	_snow_trace_event('B', "user", (name))
+#define snow_trace_end() \
+	_snow_trace_event('E', NULL, NULL)
+
+#ifdef SNOW_VIRTUAL_TIME
+#define snow_advance_time(msec) \
+	_snow_vtime_advance((int64_t)((msec) * 1000000.0))
+#else
+#define snow_advance_time(msec) \
+	do { \
+		(void)(msec); \
+		fail("snow_advance_time requires SNOW_VIRTUAL_TIME."); \
+	} while (0)
+#endif
+
+/*
+ * Keep the optimizer from throwing away benchmarked code whose results
+ * aren't used, with SNOW_OPTIMIZE_BODIES or in functions called by tests.
+ */
+#define snow_do_not_optimize(x) \
+	__asm__ __volatile__("" : : "g"(x) : "memory")
+#define snow_clobber_memory() \
+	__asm__ __volatile__("" : : : "memory")
+
 #define fail(...) \
 	do { \
 		snow_fail_update(); \
@@ -1210,28 +6528,175 @@ cleanup:
 	} while (0)
 
 #define snow_main_decls \
+	_snow_alloc_decls \
+	_snow_vtime_decls \
+	_snow_sanitizer_decls \
 	void snow_break() {} \
 	void snow_rerun_failed() {} \
-	struct _snow _snow; \
-	int _snow_inited = 0
+	int _snow_inited = 0; \
+	__thread struct _snow_thread _snow_thread; \
+	struct _snow _snow
 
 #define snow_main() \
-	snow_main_decls; \
 	int main(int argc, char **argv) { \
 		return snow_main_function(argc, argv); \
 	} \
-	int _snow_unused_variable_for_semicolon
+	snow_main_decls
+
+/*
+ * Temporary directories
+ */
+
+/*
+ * Where snow_tmpdir creates its directories. /dev/shm is preferred,
+ * since it's a tmpfs on most Linux systems.
+ */
+__attribute__((unused))
+static const char *_snow_tmpdir_base(void) {
+	if (_snow.opts[_SNOW_OPT_TMP_DIR].strval != NULL)
+		return _snow.opts[_SNOW_OPT_TMP_DIR].strval;
+
+	struct stat st;
+	if (stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode) &&
+			access("/dev/shm", W_OK | X_OK) == 0)
+		return "/dev/shm";
+
+	char *tmp = getenv("TMPDIR");
+	if (tmp != NULL && tmp[0] != '\0')
+		return tmp;
+
+	return "/tmp";
+}
+
+/*
+ * Create the test case's directory the first time it's asked for.
+ */
+__attribute__((unused))
+static const char *_snow_tmpdir(const char *file, int line) {
+	if (_snow.current_case.tmpdir[0] != '\0')
+		return _snow.current_case.tmpdir;
+
+	// The directory is only removed at the end of a test case
+	if (!_snow.in_case)
+		return NULL;
+
+	_snow_thread.filename = file;
+	_snow_thread.linenum = line;
+
+#ifdef __MINGW32__
+	snow_fail("snow_tmpdir isn't supported on Windows.");
+	return NULL;
+#else
+	const char *base = _snow_tmpdir_base();
+	char path[sizeof(_snow.current_case.tmpdir)];
+	int len = snprintf(path, sizeof(path), "%s/snow.XXXXXX", base);
+	if (len < 0 || (size_t)len >= sizeof(path)) {
+		snow_fail("Temporary directory path too long: %s", base);
+		return NULL;
+	}
+
+	if (mkdtemp(path) == NULL) {
+		snow_fail("Can't create a temporary directory in %s: %s",
+			base, strerror(errno));
+		return NULL;
+	}
+
+	strcpy(_snow.current_case.tmpdir, path);
+	return _snow.current_case.tmpdir;
+#endif
+}
+
+/*
+ * Remove a directory and everything in it, without following symlinks.
+ */
+__attribute__((unused))
+static int _snow_rmtree(const char *path) {
+#ifdef __MINGW32__
+	return rmdir(path);
+#else
+	DIR *dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+
+	int ret = 0;
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL) {
+		if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
+
+		char child[PATH_MAX];
+		int len = snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+		if (len < 0 || (size_t)len >= sizeof(child)) {
+			ret = -1;
+			continue;
+		}
+
+		struct stat st;
+		if (lstat(child, &st) < 0)
+			ret = -1;
+		else if (S_ISDIR(st.st_mode))
+			ret |= _snow_rmtree(child);
+		else if (unlink(child) < 0)
+			ret = -1;
+	}
+
+	closedir(dir);
+	if (rmdir(path) < 0)
+		ret = -1;
+	return ret;
+#endif
+}
+
+/*
+ * Called after a test case's defers and after_each. The directory is
+ * kept if the test case failed, so that it can be looked at.
+ */
+__attribute__((unused))
+static void _snow_case_tmpdir_end(void) {
+	char *path = _snow.current_case.tmpdir;
+	if (path[0] == '\0')
+		return;
+
+	int success = _snow.current_case.success;
+	if (!success || _snow.opts[_SNOW_OPT_KEEP_TMP].boolval) {
+		if (!success || _snow_print_cases())
+			_snow_print("%s    Kept %s\n",
+				_snow_spaces(_snow.desc_stack.length - 1), path);
+	} else if (_snow_rmtree(path) < 0) {
+		perror(path);
+	}
+
+	path[0] = '\0';
+}
 
 /*
  * Assert
  */
 
+/*
+ * Every assertion bumps the assertion counter and does its comparison
+ * inline. Only when the comparison fails do we record the file/line and
+ * call out to the functions which format the failure message.
+ *
+ * Assertions may run on threads started by the test. Those add to their
+ * own counter atomically, so the test case's thread keeps a plain increment.
+ */
+#define _snow_count_assert() \
+	do { \
+		if (_snow_thread.is_case_thread) \
+			_snow.current_case.num_asserts += 1; \
+		else \
+			__atomic_fetch_add( \
+				&_snow.current_case.thread_asserts, 1, __ATOMIC_RELAXED); \
+	} while (0)
+
 #define assert(x, expl...) \
 	do { \
-		snow_fail_update(); \
-		const char *_snow_explanation = "" expl; \
-		if (!(x)) \
-			_snow_fail_expl(_snow_explanation, "Assertion failed: %s", #x); \
+		_snow_count_assert(); \
+		if (__builtin_expect(!(x), 0)) { \
+			snow_fail_update(); \
+			_snow_fail_expl("" expl, "Assertion failed: %s", #x); \
+		} \
 	} while (0)
 
 /*
@@ -1239,6 +6704,11 @@ cleanup:
  */
 
 #define _snow_define_assertfunc(name, type, pattern) \
+	__attribute__((unused)) \
+	static inline __attribute__((always_inline)) int _snow_check_##name( \
+			int invert, const type a, const type b) { \
+		return ((a) == (b)) != invert; \
+	} \
 	__attribute__((unused)) \
 	static int _snow_assert_##name( \
 			int invert, const char *explanation, \
@@ -1259,6 +6729,12 @@ _snow_define_assertfunc(uint, uintmax_t, "%ju")
 _snow_define_assertfunc(dbl, long double, "%Lg")
 _snow_define_assertfunc(ptr, void *, "%p")
 
+__attribute__((unused))
+static inline __attribute__((always_inline)) int _snow_check_str(
+		int invert, const char *a, const char *b) {
+	return (strcmp(a, b) == 0) != invert;
+}
+
 __attribute__((unused))
 static int _snow_assert_str(
 		int invert, const char *explanation,
@@ -1291,6 +6767,33 @@ static int _snow_assert_buf(
 	return 0;
 }
 
+/*
+ * Used by asserteq_any and assertneq_any, and by asserteq and assertneq
+ * for types which aren't handled by _snow_generic_assert.
+ */
+__attribute__((unused))
+static int _snow_assert_any(
+		int invert, const char *explanation,
+		const void *a, size_t asize, const char *astr,
+		const void *b, size_t bsize, const char *bstr) {
+	if (asize != bsize) {
+		if (!invert)
+			_snow_fail_expl(explanation,
+				"Expected %s to equal %s, but their lengths don't match",
+				astr, bstr);
+		return 0;
+	}
+
+	return _snow_assert_buf(invert, explanation, a, astr, b, bstr, asize);
+}
+
+__attribute__((unused))
+static inline __attribute__((always_inline)) int _snow_check_fake(
+		int invert, ...) {
+	(void)invert;
+	return -1;
+}
+
 __attribute__((unused))
 static int _snow_assert_fake(int invert, ...) {
 	(void)invert;
@@ -1300,184 +6803,670 @@ static int _snow_assert_fake(int invert, ...) {
 // In mingw and on ARM, size_t is compatible with unsigned int, and
 // ssize_t is compatible with int
 #if(__SIZEOF_SIZE_T__ == __SIZEOF_INT__)
-#define _snow_generic_assert(x) \
+#define _snow_generic_func(x, prefix) \
 	_Generic((x), \
-		float: _snow_assert_dbl, \
-		double: _snow_assert_dbl, \
-		long double: _snow_assert_dbl, \
-		void *: _snow_assert_ptr, \
-		char *: _snow_assert_str, \
-		int: _snow_assert_int, \
-		long long: _snow_assert_int, \
-		unsigned int: _snow_assert_uint, \
-		unsigned long long: _snow_assert_uint, \
-		default: _snow_assert_fake)
+		float: prefix##_dbl, \
+		double: prefix##_dbl, \
+		long double: prefix##_dbl, \
+		void *: prefix##_ptr, \
+		char *: prefix##_str, \
+		int: prefix##_int, \
+		long long: prefix##_int, \
+		unsigned int: prefix##_uint, \
+		unsigned long long: prefix##_uint, \
+		default: prefix##_fake)
 #else
-#define _snow_generic_assert(x) \
+#define _snow_generic_func(x, prefix) \
 	_Generic((x), \
-		float: _snow_assert_dbl, \
-		double: _snow_assert_dbl, \
-		long double: _snow_assert_dbl, \
-		void *: _snow_assert_ptr, \
-		char *: _snow_assert_str, \
-		int: _snow_assert_int, \
-		long long: _snow_assert_int, \
-		ssize_t: _snow_assert_int, \
-		unsigned int: _snow_assert_uint, \
-		unsigned long long: _snow_assert_uint, \
-		size_t: _snow_assert_uint, \
-		default: _snow_assert_fake)
+		float: prefix##_dbl, \
+		double: prefix##_dbl, \
+		long double: prefix##_dbl, \
+		void *: prefix##_ptr, \
+		char *: prefix##_str, \
+		int: prefix##_int, \
+		long long: prefix##_int, \
+		ssize_t: prefix##_int, \
+		unsigned int: prefix##_uint, \
+		unsigned long long: prefix##_uint, \
+		size_t: prefix##_uint, \
+		default: prefix##_fake)
 #endif
+#define _snow_generic_assert(x) _snow_generic_func(x, _snow_assert)
+#define _snow_generic_check(x) _snow_generic_func(x, _snow_check)
 
 /*
- * Explicit asserteq macros
+ * Shared implementation of the explicitly typed assert macros.
+ * 'check' is an expression of _snow_a and _snow_b which is true if
+ * the assertion passes.
  */
-
-#define asserteq_dbl(a, b, expl...) \
-	do { \
-		snow_fail_update(); \
-		_snow_assert_dbl( \
-			0, "" expl, (a), #a, (b), #b); \
-	} while (0)
-#define asserteq_ptr(a, b, expl...) \
-	do { \
-		snow_fail_update(); \
-		_snow_assert_ptr( \
-			0, "" expl, (a), #a, (b), #b); \
-	} while (0)
-#define asserteq_str(a, b, expl...) \
-	do { \
-		snow_fail_update(); \
-		_snow_assert_str( \
-			0, "" expl, (a), #a, (b), #b); \
-	} while (0)
-#define asserteq_int(a, b, expl...) \
-	do { \
-		snow_fail_update(); \
-		_snow_assert_int( \
-			0, "" expl, (a), #a, (b), #b); \
-	} while (0)
-#define asserteq_uint(a, b, expl...) \
+#define _snow_assert_typed(name, type, invert, check, a, b, expl...) \
 	do { \
-		snow_fail_update(); \
-		_snow_assert_uint( \
-			0, "" expl, (a), #a, (b), #b); \
+		type const _snow_a = (a); \
+		type const _snow_b = (b); \
+		_snow_count_assert(); \
+		if (__builtin_expect(!(check), 0)) { \
+			snow_fail_update(); \
+			_snow_assert_##name( \
+				invert, "" expl, _snow_a, #a, _snow_b, #b); \
+		} \
 	} while (0)
-#define asserteq_buf(a, b, size, expl...) \
+
+/*
+ * Shared implementation of asserteq_any and assertneq_any.
+ */
+#define _snow_assert_any_impl(invert, a, b, expl...) \
 	do { \
-		snow_fail_update(); \
-		_snow_assert_buf( \
-			0, "" expl, (a), #a, (b), #b, size); \
+		_Pragma("GCC diagnostic push") \
+		_Pragma("GCC diagnostic ignored \"-Wpragmas\"") \
+		_Pragma("GCC diagnostic ignored \"-Wpointer-arith\"") \
+		_Pragma("GCC diagnostic ignored \"-Wnull-pointer-arithmetic\"") \
+		typeof ((a)+0) _snow_a = a; \
+		typeof ((b)+0) _snow_b = b; \
+		_Pragma("GCC diagnostic pop") \
+		_snow_count_assert(); \
+		int _snow_eq = sizeof(_snow_a) == sizeof(_snow_b) && /* NOLINT */ \
+			memcmp(&_snow_a, &_snow_b, sizeof(_snow_a)) == 0; \
+		if (__builtin_expect(_snow_eq == invert, 0)) { \
+			snow_fail_update(); \
+			_snow_assert_any(invert, "" expl, \
+				&_snow_a, sizeof(_snow_a), #a, \
+				&_snow_b, sizeof(_snow_b), #b); \
+		} \
 	} while (0)
-#define asserteq_any(a, b, expl...) \
+
+/*
+ * Shared implementation of asserteq and assertneq. The argument copies
+ * make sure 'a' and 'b' are only evaluated once, and the type of 'b'
+ * decides which comparison to do.
+ */
+#define _snow_assert_generic(invert, a, b, expl...) \
 	do { \
-		snow_fail_update(); \
-		const char *_snow_explanation = "" expl; \
 		_Pragma("GCC diagnostic push") \
 		_Pragma("GCC diagnostic ignored \"-Wpragmas\"") \
 		_Pragma("GCC diagnostic ignored \"-Wpointer-arith\"") \
 		_Pragma("GCC diagnostic ignored \"-Wnull-pointer-arithmetic\"") \
-		typeof ((a)+0) _a = a; \
-		typeof ((b)+0) _b = b; \
+		typeof ((a)+0) _snow_a = a; \
+		typeof ((b)+0) _snow_b = b; \
 		_Pragma("GCC diagnostic pop") \
-		if (sizeof(_a) != sizeof(_b)) { /* NOLINT */ \
-			_snow_fail_expl(_snow_explanation, \
-				"Expected %s to equal %s, but their lengths don't match", \
-				#a, #b); \
-		} else { \
+		_snow_count_assert(); \
+		int _snow_ok = _snow_generic_check(_snow_b)( \
+			invert, _snow_a, _snow_b); \
+		if (_snow_ok < 0) { \
+			_snow_ok = (sizeof(_snow_a) == sizeof(_snow_b) && /* NOLINT */ \
+				memcmp(&_snow_a, &_snow_b, sizeof(_snow_a)) == 0) != invert; \
+		} \
+		if (__builtin_expect(!_snow_ok, 0)) { \
+			snow_fail_update(); \
+			const char *_snow_explanation = "" expl; \
+			int _snow_ret = _snow_generic_assert(_snow_b)( \
+				invert, _snow_explanation, _snow_a, #a, _snow_b, #b); \
+			if (_snow_ret < 0) { \
+				_snow_assert_any(invert, _snow_explanation, \
+					&_snow_a, sizeof(_snow_a), #a, \
+					&_snow_b, sizeof(_snow_b), #b); \
+			} \
+		} \
+	} while (0)
+
+/*
+ * Explicit asserteq macros
+ */
+
+#define asserteq_dbl(a, b, expl...) \
+	_snow_assert_typed(dbl, long double, 0, _snow_a == _snow_b, a, b, expl)
+#define asserteq_ptr(a, b, expl...) \
+	_snow_assert_typed(ptr, void *, 0, _snow_a == _snow_b, a, b, expl)
+#define asserteq_str(a, b, expl...) \
+	_snow_assert_typed(str, const char *, 0, \
+		strcmp(_snow_a, _snow_b) == 0, a, b, expl)
+#define asserteq_int(a, b, expl...) \
+	_snow_assert_typed(int, intmax_t, 0, _snow_a == _snow_b, a, b, expl)
+#define asserteq_uint(a, b, expl...) \
+	_snow_assert_typed(uint, uintmax_t, 0, _snow_a == _snow_b, a, b, expl)
+#define asserteq_buf(a, b, size, expl...) \
+	do { \
+		const void *_snow_a = (a); \
+		const void *_snow_b = (b); \
+		size_t _snow_size = (size); \
+		_snow_count_assert(); \
+		if (__builtin_expect(memcmp(_snow_a, _snow_b, _snow_size) != 0, 0)) { \
+			snow_fail_update(); \
 			_snow_assert_buf( \
-				0, _snow_explanation, &_a, #a, &_b, #b, sizeof(_a)); \
+				0, "" expl, _snow_a, #a, _snow_b, #b, _snow_size); \
 		} \
 	} while (0)
+#define asserteq_any(a, b, expl...) \
+	_snow_assert_any_impl(0, a, b, expl)
 
 /*
  * Explicit assertneq macros
  */
 
 #define assertneq_dbl(a, b, expl...) \
-	do { \
-		snow_fail_update(); \
-		_snow_assert_dbl( \
-			1, "" expl, (a), #a, (b), #b); \
-	} while (0)
+	_snow_assert_typed(dbl, long double, 1, _snow_a != _snow_b, a, b, expl)
 #define assertneq_ptr(a, b, expl...) \
-	do { \
-		snow_fail_update(); \
-		_snow_assert_ptr( \
-			1, "" expl, (a), #a, (b), #b); \
-	} while (0)
+	_snow_assert_typed(ptr, void *, 1, _snow_a != _snow_b, a, b, expl)
 #define assertneq_str(a, b, expl...) \
-	do { \
-		snow_fail_update(); \
-		_snow_assert_str( \
-			1, "" expl, (a), #a, (b), #b); \
-	} while (0)
+	_snow_assert_typed(str, const char *, 1, \
+		strcmp(_snow_a, _snow_b) != 0, a, b, expl)
 #define assertneq_int(a, b, expl...) \
+	_snow_assert_typed(int, intmax_t, 1, _snow_a != _snow_b, a, b, expl)
+#define assertneq_uint(a, b, expl...) \
+	_snow_assert_typed(uint, uintmax_t, 1, _snow_a != _snow_b, a, b, expl)
+#define assertneq_buf(a, b, size, expl...) \
 	do { \
-		snow_fail_update(); \
-		_snow_assert_int( \
-			1, "" expl, (a), #a, (b), #b); \
+		const void *_snow_a = (a); \
+		const void *_snow_b = (b); \
+		size_t _snow_size = (size); \
+		_snow_count_assert(); \
+		if (__builtin_expect(memcmp(_snow_a, _snow_b, _snow_size) == 0, 0)) { \
+			snow_fail_update(); \
+			_snow_assert_buf( \
+				1, "" expl, _snow_a, #a, _snow_b, #b, _snow_size); \
+		} \
 	} while (0)
-#define assertneq_uint(a, b, expl...) \
+#define assertneq_any(a, b, expl...) \
+	_snow_assert_any_impl(1, a, b, expl)
+
+/*
+ * Automatic asserteq
+ */
+
+#define asserteq(a, b, expl...) \
+	_snow_assert_generic(0, a, b, expl)
+
+/*
+ * Automatic assertneq
+ */
+
+#define assertneq(a, b, expl...) \
+	_snow_assert_generic(1, a, b, expl)
+
+/*
+ * Golden files
+ */
+
+#define _SNOW_GOLDEN_CHUNK (1024 * 1024)
+
+// How much is read at a time from streams which can't be mapped
+#define _SNOW_GOLDEN_READ_CHUNK (64 * 1024)
+
+enum _snow_golden_status {
+	_SNOW_GOLDEN_MATCH,
+	_SNOW_GOLDEN_MISMATCH,
+	_SNOW_GOLDEN_NO_FILE,
+	_SNOW_GOLDEN_READ_ERROR,
+	_SNOW_GOLDEN_WRITE_ERROR,
+};
+
+struct _snow_golden {
+	const unsigned char *data;
+	size_t size;
+	int mapped;
+};
+
+/*
+ * Map a golden file into memory. Falls back to reading it into a heap buffer
+ * if it can't be mapped (or if SNOW_USE_MMAP is 0).
+ */
+__attribute__((unused))
+static int _snow_golden_open(struct _snow_golden *g, const char *path) {
+	g->data = NULL;
+	g->size = 0;
+	g->mapped = 0;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	g->size = st.st_size;
+	if (g->size == 0) {
+		close(fd);
+		return 0;
+	}
+
+#if SNOW_USE_MMAP != 0
+	void *data = mmap(NULL, g->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data != MAP_FAILED) {
+		posix_madvise(data, g->size, POSIX_MADV_SEQUENTIAL);
+		close(fd);
+		g->data = data;
+		g->mapped = 1;
+		return 0;
+	}
+#endif
+
+	unsigned char *buf = _snow_malloc(g->size);
+	if (buf == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	size_t done = 0;
+	while (done < g->size) {
+		ssize_t n = read(fd, buf + done, g->size - done);
+		if (n <= 0) {
+			_snow_free(buf);
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+
+	close(fd);
+	g->data = buf;
+	return 0;
+}
+
+__attribute__((unused))
+static void _snow_golden_close(struct _snow_golden *g) {
+#if SNOW_USE_MMAP != 0
+	if (g->mapped) {
+		munmap((void *)g->data, g->size);
+		return;
+	}
+#endif
+	_snow_free((void *)g->data);
+}
+
+/*
+ * Compare 'len' bytes at 'offset' into the golden file against 'buf',
+ * one chunk at a time. Returns the offset of the first differing byte,
+ * or (size_t)-1 if they're the same.
+ */
+__attribute__((unused))
+static size_t _snow_golden_compare(
+		struct _snow_golden *g, size_t offset, const void *buf, size_t len) {
+	const unsigned char *a = buf;
+	const unsigned char *b = g->data + offset;
+	for (size_t i = 0; i < len; i += _SNOW_GOLDEN_CHUNK) {
+		size_t n = len - i < _SNOW_GOLDEN_CHUNK ? len - i : _SNOW_GOLDEN_CHUNK;
+		if (memcmp(a + i, b + i, n) == 0)
+			continue;
+
+		for (size_t j = i; j < i + n; ++j) {
+			if (a[j] != b[j])
+				return offset + j;
+		}
+	}
+
+	return (size_t)-1;
+}
+
+/*
+ * The state of a golden file update; the new contents are written to a
+ * temporary file which replaces the golden file once it's complete.
+ */
+struct _snow_golden_writer {
+	char *tmp_path;
+	int fd;
+};
+
+__attribute__((unused))
+static int _snow_golden_writer_open(
+		struct _snow_golden_writer *w, const char *path) {
+	size_t len = strlen(path);
+	w->tmp_path = _snow_malloc(len + sizeof(".XXXXXX"));
+	if (w->tmp_path == NULL)
+		return -1;
+	memcpy(w->tmp_path, path, len);
+	memcpy(w->tmp_path + len, ".XXXXXX", sizeof(".XXXXXX"));
+#ifdef __MINGW32__
+	// There's no mkstemp, so make do with a name of our own
+	snprintf(w->tmp_path + len, sizeof(".XXXXXX"), ".%06i", (int)(getpid() % 1000000));
+	w->fd = open(w->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+#else
+	w->fd = mkstemp(w->tmp_path);
+#endif
+	if (w->fd < 0) {
+		_snow_free(w->tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * fsync the directory which contains 'path', so that a rename into it
+ * survives a crash. Not every file system supports syncing directories.
+ */
+__attribute__((unused))
+static int _snow_golden_sync_dir(const char *path) {
+#ifdef __MINGW32__
+	(void)path;
+	return 0;
+#else
+	char dir[PATH_MAX] = ".";
+	const char *slash = strrchr(path, '/');
+	if (slash == path) {
+		strcpy(dir, "/");
+	} else if (slash != NULL) {
+		if ((size_t)(slash - path) >= sizeof(dir))
+			return -1;
+		memcpy(dir, path, slash - path);
+		dir[slash - path] = '\0';
+	}
+
+	int fd = open(dir, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	int ret = 0;
+	if (fsync(fd) < 0 && errno != EINVAL)
+		ret = -1;
+	close(fd);
+	return ret;
+#endif
+}
+
+__attribute__((unused))
+static int _snow_golden_writer_write(
+		struct _snow_golden_writer *w, const void *buf, size_t len) {
+	const char *ptr = buf;
+	while (len > 0) {
+		ssize_t n = write(w->fd, ptr, len);
+		if (n < 0)
+			return -1;
+		ptr += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+__attribute__((unused))
+static int _snow_golden_writer_close(
+		struct _snow_golden_writer *w, const char *path, int ok) {
+#ifdef __MINGW32__
+	if (ok && _commit(w->fd) < 0)
+		ok = 0;
+	if (close(w->fd) < 0)
+		ok = 0;
+	// Windows' rename doesn't replace existing files
+	if (ok)
+		remove(path);
+#else
+	// Golden files should be readable like any other file,
+	// not just by us like mkstemp's files
+	mode_t mask = umask(0);
+	umask(mask);
+	if (ok && fchmod(w->fd, 0666 & ~mask) < 0)
+		ok = 0;
+	if (ok && fsync(w->fd) < 0)
+		ok = 0;
+	if (close(w->fd) < 0)
+		ok = 0;
+#endif
+	if (ok && rename(w->tmp_path, path) < 0)
+		ok = 0;
+	if (ok && _snow_golden_sync_dir(path) < 0)
+		ok = 0;
+	if (!ok)
+		unlink(w->tmp_path);
+
+	_snow_free(w->tmp_path);
+	return ok ? 0 : -1;
+}
+
+__attribute__((unused))
+static void _snow_golden_report(
+		const char *explanation, enum _snow_golden_status status,
+		const char *what, const char *path,
+		size_t diff, size_t size, size_t golden_size) {
+	switch (status) {
+	case _SNOW_GOLDEN_MATCH:
+		break;
+	case _SNOW_GOLDEN_MISMATCH:
+		if (diff != (size_t)-1) {
+			_snow_fail_expl(explanation,
+				"(golden) Expected %s to match %s, but they differ at byte %zu",
+				what, path, diff);
+		} else {
+			_snow_fail_expl(explanation,
+				"(golden) Expected %s to match %s, but got %zu bytes, expected %zu",
+				what, path, size, golden_size);
+		}
+		break;
+	case _SNOW_GOLDEN_NO_FILE:
+		_snow_fail_expl(explanation,
+			"(golden) Can't open %s (run with --update-golden to create it)",
+			path);
+		break;
+	case _SNOW_GOLDEN_READ_ERROR:
+		_snow_fail_expl(explanation,
+			"(golden) Failed to read %s", what);
+		break;
+	case _SNOW_GOLDEN_WRITE_ERROR:
+		_snow_fail_expl(explanation,
+			"(golden) Failed to update %s", path);
+		break;
+	}
+}
+
+__attribute__((unused))
+static void _snow_assert_golden_buf(
+		const char *explanation, const void *buf, size_t len,
+		const char *bufstr, const char *path) {
+	enum _snow_golden_status status = _SNOW_GOLDEN_MATCH;
+	size_t diff = (size_t)-1;
+	size_t golden_size = 0;
+
+	if (_snow.opts[_SNOW_OPT_UPDATE_GOLDEN].boolval) {
+		struct _snow_golden_writer w;
+		if (_snow_golden_writer_open(&w, path) < 0 ||
+				_snow_golden_writer_close(
+					&w, path, _snow_golden_writer_write(&w, buf, len) == 0) < 0)
+			status = _SNOW_GOLDEN_WRITE_ERROR;
+	} else {
+		struct _snow_golden g;
+		if (_snow_golden_open(&g, path) < 0) {
+			status = _SNOW_GOLDEN_NO_FILE;
+		} else {
+			golden_size = g.size;
+			diff = _snow_golden_compare(&g, 0, buf, len < g.size ? len : g.size);
+			if (diff != (size_t)-1 || len != g.size)
+				status = _SNOW_GOLDEN_MISMATCH;
+			_snow_golden_close(&g);
+		}
+	}
+
+	_snow_golden_report(
+		explanation, status, bufstr, path, diff, len, golden_size);
+}
+
+/*
+ * Compare everything which can be read from 'fd' or 'f' against the golden
+ * file, a chunk at a time. If 'fd' is a regular file, it's mapped rather
+ * than read; anything else is read through a buffer on the stack.
+ */
+__attribute__((unused))
+static void _snow_assert_golden_stream(
+		const char *explanation, int fd, FILE *f,
+		const char *what, const char *path) {
+	enum _snow_golden_status status = _SNOW_GOLDEN_MATCH;
+	size_t diff = (size_t)-1;
+	size_t size = 0;
+
+	int update = _snow.opts[_SNOW_OPT_UPDATE_GOLDEN].boolval;
+	struct _snow_golden g = { 0 };
+	struct _snow_golden_writer w;
+	if (update) {
+		if (_snow_golden_writer_open(&w, path) < 0) {
+			_snow_golden_report(explanation, _SNOW_GOLDEN_WRITE_ERROR,
+				what, path, diff, 0, 0);
+			return;
+		}
+	} else if (_snow_golden_open(&g, path) < 0) {
+		_snow_golden_report(explanation, _SNOW_GOLDEN_NO_FILE,
+			what, path, diff, 0, 0);
+		return;
+	}
+
+#if SNOW_USE_MMAP != 0
+	// Map the rest of a regular file
+	struct stat st;
+	if (f == NULL && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		off_t offset = lseek(fd, 0, SEEK_CUR);
+		long page = sysconf(_SC_PAGESIZE);
+		if (offset >= 0 && offset < st.st_size) {
+			off_t aligned = offset - offset % page;
+			size_t maplen = st.st_size - aligned;
+			void *map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fd, aligned);
+			if (map != MAP_FAILED) {
+				const char *data = (const char *)map + (offset - aligned);
+				size = st.st_size - offset;
+				if (update) {
+					if (_snow_golden_writer_write(&w, data, size) < 0)
+						status = _SNOW_GOLDEN_WRITE_ERROR;
+				} else {
+					diff = _snow_golden_compare(
+						&g, 0, data, size < g.size ? size : g.size);
+				}
+				munmap(map, maplen);
+				lseek(fd, st.st_size, SEEK_SET);
+				goto done;
+			}
+		} else if (offset >= 0) {
+			goto done;
+		}
+	}
+#endif
+
+	char chunk[_SNOW_GOLDEN_READ_CHUNK];
+	while (status == _SNOW_GOLDEN_MATCH) {
+		ssize_t n;
+		if (f != NULL) {
+			n = fread(chunk, 1, sizeof(chunk), f);
+			if (n == 0 && ferror(f))
+				n = -1;
+		} else {
+			n = read(fd, chunk, sizeof(chunk));
+		}
+
+		if (n < 0) {
+			status = _SNOW_GOLDEN_READ_ERROR;
+		} else if (n == 0) {
+			break;
+		} else if (update) {
+			if (_snow_golden_writer_write(&w, chunk, n) < 0)
+				status = _SNOW_GOLDEN_WRITE_ERROR;
+		} else if (diff == (size_t)-1 && size < g.size) {
+			size_t cmplen = (size_t)n < g.size - size ? (size_t)n : g.size - size;
+			diff = _snow_golden_compare(&g, size, chunk, cmplen);
+		}
+
+		size += n > 0 ? n : 0;
+	}
+
+done:
+	if (update) {
+		if (_snow_golden_writer_close(
+				&w, path, status == _SNOW_GOLDEN_MATCH) < 0 &&
+				status == _SNOW_GOLDEN_MATCH)
+			status = _SNOW_GOLDEN_WRITE_ERROR;
+	} else {
+		if (status == _SNOW_GOLDEN_MATCH &&
+				(diff != (size_t)-1 || size != g.size))
+			status = _SNOW_GOLDEN_MISMATCH;
+		_snow_golden_close(&g);
+	}
+
+	_snow_golden_report(
+		explanation, status, what, path, diff, size, g.size);
+}
+
+#define assert_matches_golden(buf, len, path, expl...) \
 	do { \
+		_snow_count_assert(); \
 		snow_fail_update(); \
-		_snow_assert_uint( \
-			2, "" expl, (a), #a, (b), #b); \
+		_snow_assert_golden_buf("" expl, (buf), (len), #buf, (path)); \
 	} while (0)
-#define assertneq_buf(a, b, size, expl...) \
+#define assert_matches_golden_fd(fd, path, expl...) \
 	do { \
+		_snow_count_assert(); \
 		snow_fail_update(); \
-		_snow_assert_buf( \
-			1, "" expl, (a), #a, (b), #b, (size)); \
+		_snow_assert_golden_stream("" expl, (fd), NULL, #fd, (path)); \
 	} while (0)
-#define assertneq_any(a, b, expl...) \
+#define assert_matches_golden_file(f, path, expl...) \
 	do { \
+		_snow_count_assert(); \
 		snow_fail_update(); \
-		const char *_snow_explanation = "" expl; \
-		_Pragma("GCC diagnostic push") \
-		_Pragma("GCC diagnostic ignored \"-Wpragmas\"") \
-		_Pragma("GCC diagnostic ignored \"-Wpointer-arith\"") \
-		_Pragma("GCC diagnostic ignored \"-Wnull-pointer-arithmetic\"") \
-		typeof ((a)+0) _a = a; \
-		typeof ((b)+0) _b = b; \
-		_Pragma("GCC diagnostic pop") \
-		if (sizeof(_a) != sizeof(_b)) { /* NOLINT */ \
-			break; \
-		} else { \
-			_snow_assert_buf( \
-				1, _snow_explanation, &_a, #a, &_b, #b, sizeof(_a)); \
-		} \
+		_snow_assert_golden_stream("" expl, -1, (f), #f, (path)); \
 	} while (0)
 
 /*
- * Automatic asserteq
+ * Complexity
  */
 
-#define asserteq(a, b, expl...) \
+__attribute__((unused))
+static void _snow_assert_complexity(
+		const char *explanation, enum _snow_complexity expected) {
+	if (_snow.current_case.sweep.points.length == 0)
+		_snow_fail_expl(explanation,
+			"Expected %s, but no snow_sweep has run",
+			_snow_complexity_names[expected]);
+
+	double error;
+	enum _snow_complexity complexity = _snow_sweep_fit(&error);
+	if (complexity > expected)
+		_snow_fail_expl(explanation,
+			"Expected %s or better, but the best fit is %s (rms error %.01f%%)",
+			_snow_complexity_names[expected],
+			_snow_complexity_names[complexity], error * 100);
+}
+
+#define assert_complexity(complexity, expl...) \
 	do { \
+		_snow_count_assert(); \
 		snow_fail_update(); \
-		const char *_snow_explanation = "" expl; \
-		int _snow_ret = _snow_generic_assert(b)( \
-			0, _snow_explanation, (a), #a, (b), #b); \
-		if (_snow_ret < 0) { \
-			asserteq_any(a, b, expl); \
-		} \
+		_snow_assert_complexity("" expl, _SNOW_##complexity); \
 	} while (0)
 
 /*
- * Automatic assertneq
+ * I/O budgets
  */
 
-#define assertneq(a, b, expl...) \
+__attribute__((unused))
+static void _snow_assert_io(
+		const char *explanation, const char *name, int bytes,
+		unsigned long long max) {
+	if (_snow.io.fd < 0)
+		_snow_fail_expl(explanation, "%s needs --io-stats", name);
+
+	struct _snow_io_stats io;
+	_snow_io_delta(&io);
+	if (bytes && io.read_bytes + io.written_bytes > max) {
+		_snow_fail_expl(explanation,
+			"Expected at most %llu bytes of I/O, but got %llu "
+			"(%llu read, %llu written)", max,
+			io.read_bytes + io.written_bytes,
+			io.read_bytes, io.written_bytes);
+	} else if (!bytes && io.reads + io.writes > max) {
+		_snow_fail_expl(explanation,
+			"Expected at most %llu syscalls, but got %llu "
+			"(%llu reads, %llu writes)", max,
+			io.reads + io.writes, io.reads, io.writes);
+	}
+}
+
+#define assert_syscalls_le(max, expl...) \
 	do { \
+		_snow_count_assert(); \
 		snow_fail_update(); \
-		const char *_snow_explanation = "" expl; \
-		int _snow_ret = _snow_generic_assert(b)( \
-			1, _snow_explanation, (a), #a, (b), #b); \
-		if (_snow_ret < 0) { \
-			assertneq_any(a, b, expl); \
-		} \
-} while (0)
+		_snow_assert_io("" expl, "assert_syscalls_le", 0, (max)); \
+	} while (0)
+#define assert_io_bytes_le(max, expl...) \
+	do { \
+		_snow_count_assert(); \
+		snow_fail_update(); \
+		_snow_assert_io("" expl, "assert_io_bytes_le", 1, (max)); \
+	} while (0)
 
 #endif // SNOW_ENABLED
 
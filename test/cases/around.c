@@ -76,4 +76,63 @@ describe(e) {
 		test("failure") { assert(0); }
 	}
 }
+
+describe(f) {
+	before_all() {
+		puts("F BEFORE ALL");
+	}
+	before_each() {
+		puts("F BEFORE");
+	}
+	test("success") { assert(1); }
+	test("failure") { assert(0); }
+	subdesc(ff) {
+		before_all() {
+			puts("FF BEFORE ALL");
+		}
+		test("success") { assert(1); }
+		after_all() {
+			puts("FF AFTER ALL");
+		}
+	}
+	subdesc(fg) {
+		before_all() {
+			puts("FG BEFORE ALL");
+		}
+		after_all() {
+			puts("FG AFTER ALL");
+		}
+	}
+	after_all() {
+		puts("F AFTER ALL");
+	}
+}
+
+describe(g) {
+	before_all() {
+		puts("G BEFORE ALL");
+	}
+	subdesc(gg) {
+		test("success") { assert(1); }
+	}
+	after_all() {
+		puts("G AFTER ALL");
+	}
+}
+
+describe(h) {
+	before_all() {
+		puts("H BEFORE ALL");
+		assert(0);
+		puts("H NOT REACHED");
+	}
+	test("first") { puts("H FIRST"); }
+	subdesc(hh) {
+		test("second") { puts("H SECOND"); }
+	}
+	after_all() {
+		puts("H AFTER ALL");
+	}
+}
+
 snow_main();
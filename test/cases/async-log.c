@@ -0,0 +1,21 @@
+#include <stdlib.h>
+#include <snow/snow.h>
+
+describe(exits) {
+	it("passes") {}
+
+	it("calls exit") {
+		exit(EXIT_SUCCESS);
+	}
+}
+
+describe(crashes) {
+	it("passes") {}
+
+	it("crashes") {
+		int *volatile ptr = NULL;
+		*ptr = 1;
+	}
+}
+
+snow_main();
@@ -0,0 +1,45 @@
+#include <snow/snow.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+
+static unsigned long start_mask[1024 / (8 * sizeof(unsigned long))];
+
+static void get_mask(unsigned long *mask) {
+	memset(mask, 0, sizeof(start_mask));
+	syscall(SYS_sched_getaffinity, 0, sizeof(start_mask), mask);
+}
+
+// Runs before snow_main, so before --bench-env pins anything
+__attribute__((constructor))
+static void save_start_mask(void) {
+	get_mask(start_mask);
+}
+
+static int count_cpus(const unsigned long *mask) {
+	int count = 0;
+	for (size_t i = 0; i < sizeof(start_mask) / sizeof(*mask); ++i)
+		count += __builtin_popcountl(mask[i]);
+	return count;
+}
+
+static void check_unpinned(void *arg, int thread) {
+	(void)arg;
+	(void)thread;
+	unsigned long mask[sizeof(start_mask) / sizeof(unsigned long)];
+	get_mask(mask);
+	asserteq_buf(mask, start_mask, sizeof(start_mask));
+}
+
+describe(bench) {
+	it("pins the test cases' thread to one CPU") {
+		unsigned long mask[sizeof(start_mask) / sizeof(unsigned long)];
+		get_mask(mask);
+		asserteq(count_cpus(mask), 1);
+	}
+
+	stress("gives stress threads the original CPUs", 2, 10, check_unpinned, NULL) {}
+}
+#endif
+
+snow_main();
@@ -0,0 +1,21 @@
+// Time spent in hooks can't be faked with the dummy timer
+#undef SNOW_DUMMY_TIMER
+#include <snow/snow.h>
+#include <unistd.h>
+
+describe(hooks) {
+	it("counts its defers", .budget_ms = 50) {
+		defer(usleep(100 * 1000));
+	}
+
+	subdesc(after_each) {
+		after_each() {
+			usleep(100 * 1000);
+		}
+
+		it("counts the after_each", .budget_ms = 50) {}
+		it("can opt out of --max-case-time", .budget_ms = -1) {}
+	}
+}
+
+snow_main();
@@ -0,0 +1,11 @@
+#include <snow/snow.h>
+
+describe(budgets) {
+	it("fits in its budget", .budget_ms = 10000) {}
+	it("goes over its budget", .budget_ms = 500) {}
+	it("warns about going over its budget", .budget_ms = 500, .budget_warn = 1) {}
+	it("has no budget of its own") {}
+	it("opts out of --max-case-time", .budget_ms = -1) {}
+}
+
+snow_main();
@@ -0,0 +1,44 @@
+#include <snow/snow.h>
+
+static int counter;
+
+static void *setup_counter(void) {
+	puts("SETUP COUNTER");
+	counter = 10;
+	return &counter;
+}
+
+static void teardown_counter(void *ptr) {
+	(void)ptr;
+	puts("TEARDOWN COUNTER");
+}
+
+snow_fixture(counter, setup_counter, teardown_counter);
+
+describe(a) {
+	test("doesn't use the fixture") { assert(1); }
+
+	subdesc(aa) {
+		snow_use_fixture(counter);
+		test("uses the fixture") {
+			asserteq(*(int *)snow_fixture_get(counter), 10);
+		}
+	}
+}
+
+snow_use_fixture_in(b, counter);
+describe(b) {
+	puts("DESCRIBE B");
+	test("uses the fixture") {
+		asserteq(*(int *)snow_fixture_get(counter), 10);
+	}
+	test("uses the fixture again") {
+		asserteq(*(int *)snow_fixture_get(counter), 10);
+	}
+}
+
+describe(c) {
+	test("doesn't use the fixture") { assert(1); }
+}
+
+snow_main();
@@ -0,0 +1,42 @@
+#include <snow/snow.h>
+
+#define SIZE (3 * 1024 * 1024 + 17)
+
+static FILE *tmpfile_with(const char *data, size_t size) {
+	FILE *f = tmpfile();
+	fwrite(data, 1, size, f);
+	rewind(f);
+	return f;
+}
+
+describe(golden) {
+	char *volatile data;
+
+	before_each() {
+		data = malloc(SIZE);
+		for (size_t i = 0; i < SIZE; ++i)
+			data[i] = (i * 31) ^ (i >> 10);
+	}
+
+	after_each() {
+		free(data);
+	}
+
+	it("matches a buffer") {
+		assert_matches_golden(data, SIZE, "cases/golden.tmp/buf");
+	}
+
+	it("matches a file descriptor") {
+		FILE *f = tmpfile_with(data, SIZE);
+		defer(fclose(f));
+		assert_matches_golden_fd(fileno(f), "cases/golden.tmp/fd");
+	}
+
+	it("matches a FILE") {
+		FILE *f = tmpfile_with(data, SIZE);
+		defer(fclose(f));
+		assert_matches_golden_file(f, "cases/golden.tmp/file");
+	}
+}
+
+snow_main();
@@ -0,0 +1,44 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <snow/snow.h>
+
+describe(io) {
+	volatile int fd = -1;
+
+	before_each() {
+		fd = open("/dev/null", O_RDWR);
+	}
+
+	after_each() {
+		close(fd);
+	}
+
+	it("counts writes") {
+		for (int i = 0; i < 3; ++i)
+			asserteq(write(fd, "0123456789", 10), 10);
+		assert_syscalls_le(3);
+		assert_io_bytes_le(30);
+	}
+
+	it("counts reads") {
+		char buf[100];
+		int zero = open("/dev/zero", O_RDONLY);
+		defer(close(zero));
+		asserteq(read(zero, buf, sizeof(buf)), sizeof(buf));
+		asserteq(read(zero, buf, sizeof(buf)), sizeof(buf));
+		assert_io_bytes_le(200);
+	}
+
+	it("fails with too many syscalls") {
+		for (int i = 0; i < 4; ++i)
+			asserteq(write(fd, "0123456789", 10), 10);
+		assert_syscalls_le(3);
+	}
+
+	it("fails with too many bytes") {
+		asserteq(write(fd, "0123456789", 10), 10);
+		assert_io_bytes_le(9, "the buffer is 9 bytes");
+	}
+}
+
+snow_main();
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <stdint.h>
+#ifdef __GLIBC__
+#define SNOW_TRACK_ALLOCS
+#endif
+#include <snow/snow.h>
+#include <pthread.h>
+
+static void *make_buffer(size_t size) {
+	return malloc(size);
+}
+
+static void *worker(void *arg) {
+	free(arg);
+	return NULL;
+}
+
+describe(leaks) {
+	it("passes when everything is freed") {
+		char *buf = malloc(16);
+		buf = realloc(buf, 64);
+		free(buf);
+	}
+
+	it("passes when a defer frees") {
+		void *buf = make_buffer(16);
+		defer(free(buf));
+	}
+
+	it("fails when something leaks") {
+		snow_do_not_optimize(make_buffer(32));
+		assert(calloc(4, 4) != NULL);
+	}
+
+	it("passes when another thread frees") {
+		pthread_t thread;
+		asserteq(pthread_create(&thread, NULL, worker, malloc(8)), 0);
+		pthread_join(thread, NULL);
+	}
+
+	it("fails when a block whose realloc failed leaks") {
+		volatile size_t huge = SIZE_MAX / 2;
+		void *buf = make_buffer(8);
+		asserteq(realloc(buf, huge), NULL);
+	}
+
+	subdesc(hooks) {
+		static void *buf;
+		before_each() {
+			buf = make_buffer(16);
+		}
+
+		after_each() {
+			free(buf);
+		}
+
+		it("passes when after_each frees") {
+			assertneq(buf, NULL);
+		}
+	}
+}
+
+snow_main();
@@ -0,0 +1,20 @@
+#include <snow/snow.h>
+
+// Every tab turns into six characters of JSON
+#define TABS_10 "\t\t\t\t\t\t\t\t\t\t"
+#define TABS_100 TABS_10 TABS_10 TABS_10 TABS_10 TABS_10 \
+	TABS_10 TABS_10 TABS_10 TABS_10 TABS_10
+#define TABS_1000 TABS_100 TABS_100 TABS_100 TABS_100 TABS_100 \
+	TABS_100 TABS_100 TABS_100 TABS_100 TABS_100
+
+#define QUOTES_10 "\"\\\"\\\"\\\"\\\"\\"
+#define QUOTES_100 QUOTES_10 QUOTES_10 QUOTES_10 QUOTES_10 QUOTES_10 \
+	QUOTES_10 QUOTES_10 QUOTES_10 QUOTES_10 QUOTES_10
+
+describe(list) {
+	it("\"" TABS_1000 "\"") {}
+
+	test("with long tags", .tags = QUOTES_100 ", " TABS_1000 ", short") {}
+}
+
+snow_main();
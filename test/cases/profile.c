@@ -0,0 +1,20 @@
+#include <time.h>
+#include <snow/snow.h>
+
+static volatile unsigned long counter;
+
+__attribute__((noinline))
+static void busy_loop(void) {
+	for (unsigned long i = 0; i < 100000; ++i)
+		counter += i;
+}
+
+describe(profile) {
+	it("spins for 50ms of CPU time") {
+		clock_t end = clock() + CLOCKS_PER_SEC / 20;
+		while (clock() < end)
+			busy_loop();
+	}
+}
+
+snow_main();
@@ -0,0 +1,33 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <snow/snow.h>
+
+// Built with -fsanitize=undefined and -fsanitize=address by 'make check'.
+// Volatile, so that the compiler can't see the errors coming.
+static volatile int big = INT_MAX;
+static volatile size_t past_end = 8;
+
+describe(ubsan) {
+	it("fails on a signed overflow") {
+		int sum = big + 1;
+		snow_do_not_optimize(sum);
+	}
+
+	it("keeps running after the sanitizer recovers") {
+		asserteq(big, INT_MAX);
+	}
+}
+
+describe(asan) {
+	it("passes before the sanitizer aborts") {}
+
+	it("fails on a heap buffer overflow") {
+		char *buf = malloc(8);
+		defer(free(buf));
+		snow_do_not_optimize(buf[past_end]);
+	}
+
+	it("never runs") {}
+}
+
+snow_main();
@@ -0,0 +1,44 @@
+#include <snow/snow.h>
+
+struct counter {
+	unsigned long value;
+};
+
+static void increment(void *arg, int thread) {
+	(void)thread;
+	struct counter *counter = arg;
+	__atomic_fetch_add(&counter->value, 1, __ATOMIC_RELAXED);
+}
+
+static void fail_at_100(void *arg, int thread) {
+	struct counter *counter = arg;
+	unsigned long val = __atomic_add_fetch(&counter->value, 1, __ATOMIC_RELAXED);
+	if (thread == 0)
+		assert(val < 100);
+}
+
+describe(stress) {
+	struct counter counter;
+
+	before_each() {
+		counter.value = 0;
+	}
+
+	stress("counts correctly", 4, 1000, increment, &counter) {
+		asserteq(counter.value, 4000);
+	}
+
+	stress("fails when the block fails", 4, 1000, increment, &counter) {
+		asserteq(counter.value, 0);
+	}
+
+	stress("fails when a thread fails", 4, 1000, fail_at_100, &counter) {
+		asserteq(counter.value, 4000);
+	}
+
+	after_each() {
+		assertneq(counter.value, 0);
+	}
+}
+
+snow_main();
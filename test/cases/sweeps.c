@@ -0,0 +1,38 @@
+#include <snow/snow.h>
+
+static volatile unsigned long sink;
+
+static void linear(size_t n) {
+	for (size_t i = 0; i < n; ++i)
+		sink += i;
+}
+
+static void quadratic(size_t n) {
+	for (size_t i = 0; i < n; ++i)
+		for (size_t j = 0; j < n; ++j)
+			sink += j;
+}
+
+describe(sweeps) {
+	it("passes when the scaling is as expected") {
+		size_t n;
+		snow_sweep(n, 256, 8192) {
+			linear(n);
+		}
+		assert_complexity(O_N);
+	}
+
+	it("fails when the scaling is worse than expected") {
+		size_t n;
+		snow_sweep(n, 16, 1024) {
+			quadratic(n);
+		}
+		assert_complexity(O_N);
+	}
+
+	it("fails without a sweep") {
+		assert_complexity(O_1);
+	}
+}
+
+snow_main();
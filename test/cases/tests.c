@@ -16,7 +16,7 @@ describe(c) {
 }
 
 describe(d) {
-	test("failure") { assert(0); }
+	test("failure", .tags = "slow, io") { assert(0); }
 	test("success") { assert(1); }
 }
 
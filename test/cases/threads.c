@@ -0,0 +1,68 @@
+#include <snow/snow.h>
+#include <pthread.h>
+
+static void *assert_true(void *arg) {
+	(void)arg;
+	assert(1);
+	asserteq(1, 1);
+	return NULL;
+}
+
+static void *assert_false(void *arg) {
+	(void)arg;
+	asserteq(1, 2);
+	return NULL;
+}
+
+static void *assert_many(void *arg) {
+	(void)arg;
+	for (int i = 0; i < 25000; ++i)
+		assert(1);
+	return NULL;
+}
+
+static void *fail_twice(void *arg) {
+	(void)arg;
+	fail("First failure");
+	fail("Second failure");
+	return NULL;
+}
+
+describe(threads) {
+	test("passing assertion in a thread") {
+		pthread_t thread;
+		pthread_create(&thread, NULL, assert_true, NULL);
+		pthread_join(thread, NULL);
+	}
+
+	test("failing assertion in a thread") {
+		pthread_t thread;
+		pthread_create(&thread, NULL, assert_false, NULL);
+		pthread_join(thread, NULL);
+	}
+
+	test("failing assertions in many threads") {
+		pthread_t threads[8];
+		for (int i = 0; i < 8; ++i)
+			pthread_create(&threads[i], NULL, fail_twice, NULL);
+		for (int i = 0; i < 8; ++i)
+			pthread_join(threads[i], NULL);
+	}
+
+	test("success after a thread failed") {
+		assert(1);
+	}
+}
+
+describe(counts) {
+	test("counts assertions in threads and in the test case") {
+		pthread_t threads[4];
+		for (int i = 0; i < 4; ++i)
+			pthread_create(&threads[i], NULL, assert_many, NULL);
+		assert_many(NULL);
+		for (int i = 0; i < 4; ++i)
+			pthread_join(threads[i], NULL);
+	}
+}
+
+snow_main();
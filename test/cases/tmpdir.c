@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <snow/snow.h>
+
+static char prev[PATH_MAX];
+
+static void touch(const char *dir, const char *name) {
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path))
+		return;
+	FILE *f = fopen(path, "w");
+	if (f != NULL)
+		fclose(f);
+}
+
+describe(tmpdir) {
+	after_each() {
+		touch(snow_tmpdir(), "after_each");
+	}
+
+	it("creates a directory for each test case") {
+		const char *dir = snow_tmpdir();
+		assertneq(dir, NULL);
+		asserteq(snow_tmpdir(), dir);
+		asserteq(access(dir, W_OK), 0);
+
+		char sub[PATH_MAX];
+		assert(snprintf(sub, sizeof(sub), "%s/sub", dir) < (int)sizeof(sub));
+		asserteq(mkdir(sub, 0777), 0);
+		touch(sub, "file");
+		strcpy(prev, dir);
+	}
+
+	it("removes it after the test case") {
+		assertneq(access(prev, F_OK), 0);
+		assertneq(snow_tmpdir(), prev);
+	}
+
+	it("keeps it when the test case fails") {
+		touch(snow_tmpdir(), "evidence");
+		fail("Failing on purpose");
+	}
+}
+
+snow_main();
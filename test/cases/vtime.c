@@ -0,0 +1,57 @@
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#define SNOW_VIRTUAL_TIME
+#endif
+#include <snow/snow.h>
+
+static int64_t monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+describe(vtime) {
+	it("sleeps without waiting") {
+		time_t start = time(NULL);
+		int64_t start_ns = monotonic_ns();
+		asserteq(sleep(3600), 0);
+		asserteq(time(NULL) - start, 3600);
+
+		asserteq(usleep(250000), 0);
+		struct timespec ts = { 1, 500 };
+		asserteq(nanosleep(&ts, NULL), 0);
+		asserteq(monotonic_ns() - start_ns, 3601250000500);
+	}
+
+	it("sleeps until an absolute time") {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 60;
+		asserteq(clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL), 0);
+
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		asserteq(tv.tv_sec, ts.tv_sec);
+	}
+
+	it("advances time explicitly") {
+		int64_t start_ns = monotonic_ns();
+		snow_advance_time(1500);
+		asserteq(monotonic_ns() - start_ns, 1500000000);
+	}
+
+	it("stands still unless something sleeps") {
+		int64_t start_ns = monotonic_ns();
+		for (volatile int i = 0; i < 1000000; ++i);
+		asserteq(monotonic_ns(), start_ns);
+	}
+
+	it("rejects invalid sleeps") {
+		struct timespec ts = { 0, 1000000000 };
+		asserteq(nanosleep(&ts, NULL), -1);
+		asserteq(errno, EINVAL);
+	}
+}
+
+snow_main();
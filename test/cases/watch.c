@@ -0,0 +1,23 @@
+#include <stdlib.h>
+#include <fcntl.h>
+#include <snow/snow.h>
+
+describe(first) {
+	it("runs after the describes which failed last time") {}
+}
+
+describe(second) {
+	it("runs first") {}
+
+	it("doesn't pass the watcher's state on") {
+		asserteq(getenv("SNOW_WATCH_FD"), NULL);
+		asserteq(getenv("SNOW_WATCH_FIRST"), NULL);
+		asserteq(fcntl(3, F_GETFD) & FD_CLOEXEC, FD_CLOEXEC);
+	}
+
+	it("reports failures") {
+		fail("Failing on purpose");
+	}
+}
+
+snow_main();
@@ -231,6 +231,299 @@ describe(asserts) {
 	pclose(f);
 }
 
+describe(threads) {
+	FILE *f = runcmd("./cases/threads");
+
+	test("assertions in threads") {
+		int results[4];
+		asserteq(getResults(f, results, 4), 4);
+
+		asserteq(results[0], SUCCESS);
+		asserteq(results[1], FAILURE);
+		asserteq(results[2], FAILURE);
+		asserteq(results[3], SUCCESS);
+	}
+
+	pclose(f);
+
+	test("counts every assertion made in threads") {
+		assert(compareOutput(
+			"./cases/threads --assert-stats counts", "threads-assert-stats"));
+	}
+}
+
+describe(stress) {
+	test("stress tests") {
+		FILE *f = runcmd("./cases/stress");
+		defer(pclose(f));
+
+		int results[3];
+		asserteq(getResults(f, results, 3), 3);
+
+		asserteq(results[0], SUCCESS);
+		asserteq(results[1], FAILURE);
+		asserteq(results[2], FAILURE);
+	}
+}
+
+describe(sweeps) {
+	test("complexity assertions") {
+		FILE *f = runcmd("./cases/sweeps");
+		defer(pclose(f));
+
+		int results[3];
+		asserteq(getResults(f, results, 3), 3);
+
+		asserteq(results[0], SUCCESS);
+		asserteq(results[1], FAILURE);
+		asserteq(results[2], FAILURE);
+	}
+
+}
+
+#ifdef __GLIBC__
+describe(profile) {
+	test("writes folded stacks with --profile") {
+		FILE *out = runcmd("./cases/profile --profile profile.tmp");
+		assertneq(out, NULL);
+		while (getc(out) != EOF);
+		pclose(out);
+		defer(unlink("profile.tmp"));
+
+		FILE *f = fopen("profile.tmp", "r");
+		assertneq(f, NULL);
+		defer(fclose(f));
+
+		char line[1024];
+		int found = 0;
+		while (fgets(line, sizeof(line), f) != NULL) {
+			char *count = strrchr(line, ' ');
+			assertneq(count, NULL);
+			assert(atoi(count + 1) > 0);
+			assert(strncmp(line, "profile;spins for 50ms of CPU time;", 35) == 0);
+			if (strstr(line, ";busy_loop") != NULL)
+				found = 1;
+		}
+		assert(found);
+	}
+}
+#endif
+
+#ifdef __linux__
+describe(bench) {
+	test("--bench-env pins only the test cases' thread") {
+		FILE *f = runcmd("./cases/bench --bench-env --bench-cpu 0 2>&1");
+		assertneq(f, NULL);
+		defer(pclose(f));
+
+		int results[2];
+		asserteq(getResults(f, results, 2), 2);
+		asserteq(results[0], SUCCESS);
+		asserteq(results[1], SUCCESS);
+	}
+
+	test("--bench-env doesn't warn about the priority") {
+		FILE *f = runcmd("./cases/bench --bench-env --bench-cpu 0 2>&1");
+		assertneq(f, NULL);
+		defer(pclose(f));
+
+		char line[512];
+		int nice = 0;
+		while (fgets(line, sizeof(line), f) != NULL) {
+			assert(strstr(line, "priority") == NULL);
+			if (strncmp(line, "    Nice:", 9) == 0)
+				nice += 1;
+		}
+		asserteq(nice, 1);
+	}
+}
+
+describe(vtime) {
+	it("SNOW_VIRTUAL_TIME fast-forwards sleeps and clocks") {
+		assert(compareOutput("./cases/vtime", "vtime"));
+	}
+}
+#endif
+
+#ifndef __MINGW32__
+describe(tmpdir) {
+	test("snow_tmpdir is removed after passing tests, kept after failing ones") {
+		FILE *f = runcmd("./cases/tmpdir");
+		defer(pclose(f));
+
+		int results[3];
+		asserteq(getResults(f, results, 3), 3);
+		asserteq(results[0], SUCCESS);
+		asserteq(results[1], SUCCESS);
+		asserteq(results[2], FAILURE);
+
+		char line[512];
+		char *kept = NULL;
+		while (kept == NULL && fgets(line, sizeof(line), f) != NULL)
+			kept = strstr(line, "Kept ");
+		assertneq(kept, NULL);
+		kept += strlen("Kept ");
+		kept[strcspn(kept, "\n")] = '\0';
+
+		char cmd[600];
+		snprintf(cmd, sizeof(cmd), "test -f %s/evidence && rm -r %s", kept, kept);
+		asserteq(system(cmd), 0);
+	}
+}
+#endif
+
+#ifdef __linux__
+describe(io) {
+	it("--io-stats counts syscalls and bytes, and checks budgets") {
+		assert(compareOutput("./cases/io --io-stats", "io"));
+	}
+}
+#endif
+
+#ifdef __GLIBC__
+describe(leaks) {
+	test("SNOW_TRACK_ALLOCS fails test cases which leak") {
+		FILE *f = runcmd("./cases/leaks");
+		defer(pclose(f));
+
+		int results[6];
+		asserteq(getResults(f, results, 6), 6);
+
+		asserteq(results[0], SUCCESS);
+		asserteq(results[1], SUCCESS);
+		asserteq(results[2], FAILURE);
+		asserteq(results[3], SUCCESS);
+		asserteq(results[4], FAILURE);
+		asserteq(results[5], SUCCESS);
+	}
+
+	test("SNOW_TRACK_ALLOCS reports what leaked and where") {
+		FILE *f = runcmd("./cases/leaks -q");
+		defer(pclose(f));
+
+		char line[256];
+		int found = 0;
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (strcmp(line, "    Leaked 48 bytes in 2 allocations.\n") == 0)
+				found |= 1;
+			if (strcmp(line, "        snow_test_leaks\n") == 0)
+				found |= 2;
+		}
+		asserteq(found, 3);
+	}
+}
+#endif
+
+static void corrupt(const char *path, long offset)
+{
+	FILE *f = fopen(path, "r+b");
+	fseek(f, offset, SEEK_SET);
+	int c = getc(f);
+	fseek(f, offset, SEEK_SET);
+	putc(c ^ 1, f);
+	fclose(f);
+}
+
+describe(golden) {
+	before_each() {
+		pclose(runcmd("rm -rf cases/golden.tmp && mkdir cases/golden.tmp"));
+	}
+
+	after_each() {
+		pclose(runcmd("rm -rf cases/golden.tmp"));
+	}
+
+	test("golden files") {
+		int results[3];
+		FILE *f;
+
+		f = runcmd("./cases/golden");
+		asserteq(getResults(f, results, 3), 3);
+		pclose(f);
+		asserteq(results[0], FAILURE);
+		asserteq(results[1], FAILURE);
+		asserteq(results[2], FAILURE);
+
+		f = runcmd("./cases/golden --update-golden");
+		asserteq(getResults(f, results, 3), 3);
+		pclose(f);
+		asserteq(results[0], SUCCESS);
+		asserteq(results[1], SUCCESS);
+		asserteq(results[2], SUCCESS);
+
+		f = runcmd("./cases/golden");
+		asserteq(getResults(f, results, 3), 3);
+		pclose(f);
+		asserteq(results[0], SUCCESS);
+		asserteq(results[1], SUCCESS);
+		asserteq(results[2], SUCCESS);
+
+		corrupt("cases/golden.tmp/buf", 2500000);
+		corrupt("cases/golden.tmp/fd", 0);
+		corrupt("cases/golden.tmp/file", 3 * 1024 * 1024 + 16);
+
+		f = runcmd("./cases/golden");
+		asserteq(getResults(f, results, 3), 3);
+		pclose(f);
+		asserteq(results[0], FAILURE);
+		asserteq(results[1], FAILURE);
+		asserteq(results[2], FAILURE);
+	}
+}
+
+#ifdef __linux__
+describe(watch) {
+	after_each() {
+		remove("cases/watch.tmp");
+	}
+
+	it("runs the describes which failed last time first, and reports failures") {
+		assert(compareOutput(
+			"SNOW_WATCH_FIRST=second SNOW_WATCH_FD=3 ./cases/watch 3>cases/watch.tmp",
+			"watch"));
+
+		FILE *f = fopen("cases/watch.tmp", "r");
+		assertneq(f, NULL);
+		defer(fclose(f));
+		char buf[64] = { 0 };
+		asserteq(fread(buf, 1, sizeof(buf) - 1, f), strlen("second\n"));
+		asserteq(buf, "second\n");
+	}
+
+	it("re-runs when the binary changes, and exits with the last status") {
+		assert(compareOutput(
+			"./cases/watch --watch --no-timer & pid=$!; "
+			"sleep 1; touch cases/watch; sleep 1.5; "
+			"kill -INT $pid; wait $pid; echo status $?",
+			"watch-rerun"));
+	}
+}
+#endif
+
+describe(fixtures) {
+	it("sets up fixtures lazily and tears them down after their last describe") {
+		assert(compareOutput("./cases/fixtures", "fixtures"));
+	}
+}
+
+describe(budgets) {
+	it("fails tests which go over their time budget") {
+		assert(compareOutput("./cases/budgets --max-case-time 500", "budgets"));
+	}
+
+	it("counts defers and after_each towards the budget") {
+		FILE *f = runcmd("./cases/budget-hooks --max-case-time 50");
+		assertneq(f, NULL);
+		defer(pclose(f));
+
+		int results[3];
+		asserteq(getResults(f, results, 3), 3);
+		asserteq(results[0], FAILURE);
+		asserteq(results[1], FAILURE);
+		asserteq(results[2], SUCCESS);
+	}
+}
+
 describe(commandline) {
 // When running with git bash, argv[0] will be an absolute path, so
 // this test case would fail, because it assumes the -h option prints
@@ -262,6 +555,18 @@ describe(commandline) {
 		assert(compareOutput("./cases/commandline --no-timer", "commandline-no-timer"));
 	}
 
+	it("prints assertion counts with --assert-stats") {
+		assert(compareOutput("./cases/commandline --assert-stats", "commandline-assert-stats"));
+	}
+
+	it("skips tests which passed before with --cache") {
+		pclose(runcmd("./cases/commandline --cache cases/cache.tmp"));
+		defer(pclose(runcmd("rm -rf cases/cache.tmp")));
+		assert(compareOutput(
+			"./cases/commandline --no-timer --cache cases/cache.tmp",
+			"commandline-cache"));
+	}
+
 	it("logs to the file specified with --log") {
 		int res = compareOutput("./cases/commandline --log tmpfile", "commandline-log-stdout");
 		defer(unlink("tmpfile"));
@@ -277,6 +582,43 @@ describe(commandline) {
 
 		assert(compareFiles(f1, f2));
 	}
+
+	it("logs to stdout and multiple files with --tee and --async-log") {
+		int res = compareOutput(
+			"./cases/commandline --async-log --tee --log tmpfile --log tmpfile2",
+			"commandline-log-output");
+		defer(unlink("tmpfile"));
+		defer(unlink("tmpfile2"));
+		assert(res);
+
+		FILE *f1 = fopen("tmpfile", "r");
+		assertneq(f1, NULL);
+		defer(fclose(f1));
+		FILE *f2 = fopen("tmpfile2", "r");
+		assertneq(f2, NULL);
+		defer(fclose(f2));
+		FILE *f3 = fopen("./expected/commandline-log-output", "r");
+		assertneq(f3, NULL);
+		defer(fclose(f3));
+
+		assert(compareFiles(f1, f3));
+		rewind(f3);
+		assert(compareFiles(f2, f3));
+	}
+
+	it("writes everything with --async-log when a test calls exit") {
+		assert(compareOutput(
+			"./cases/async-log --async-log --maybes --no-timer exits",
+			"async-log-exit"));
+	}
+
+#ifndef __MINGW32__
+	it("writes everything with --async-log when a test crashes") {
+		assert(compareOutput(
+			"./cases/async-log --async-log --maybes --no-timer crashes 2>/dev/null",
+			"async-log-crash"));
+	}
+#endif
 }
 
 describe(tests) {
@@ -292,6 +634,26 @@ describe(tests) {
 		assert(compareOutput("./cases/tests a", "tests-single"));
 	}
 
+	it("lists every test case as JSON") {
+		assert(compareOutput("./cases/tests --list --format=json", "tests-list-json"));
+	}
+
+	it("lists test cases with long names and tags as JSON") {
+		assert(compareOutput("./cases/list --list --format=json", "list-json"));
+	}
+
+	it("runs exactly one test case with --run-id") {
+		assert(compareOutput("./cases/tests --run-id c/success#2", "tests-run-id"));
+	}
+
+	it("prints the slowest tests with --slowest") {
+		assert(compareOutput("./cases/tests --slowest 3", "tests-slowest"));
+	}
+
+	it("only prints failures and summaries with --progress") {
+		assert(compareOutput("./cases/tests --progress", "tests-progress"));
+	}
+
 #ifndef __MINGW32__
 	it("fails when asked to run a non-existant test suite") {
 		asserteq(
@@ -321,7 +683,70 @@ describe(around) {
 	it("before_each and after_each in subdesc should shadow the parent") {
 		assert(compareOutput("./cases/around e", "around-subdesc-before-after-shadow"));
 	}
+
+	it("writes balanced trace events with --trace") {
+		FILE *out = runcmd("./cases/around --trace trace.tmp");
+		assertneq(out, NULL);
+		while (getc(out) != EOF);
+		pclose(out);
+		defer(unlink("trace.tmp"));
+
+		FILE *f = fopen("trace.tmp", "r");
+		assertneq(f, NULL);
+		defer(fclose(f));
+
+		char line[512];
+		int begins = 0, ends = 0, depth = 0;
+		assertneq(fgets(line, sizeof(line), f), NULL);
+		asserteq(line, "[\n");
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (strstr(line, "\"ph\":\"B\"") != NULL) {
+				begins += 1;
+				depth += 1;
+			} else if (strstr(line, "\"ph\":\"E\"") != NULL) {
+				ends += 1;
+				depth -= 1;
+				assert(depth >= 0);
+			}
+		}
+		asserteq(line, "]\n");
+		assert(begins > 0);
+		asserteq(begins, ends);
+	}
+
+	it("before_all and after_all should run once around a desc's tests") {
+		assert(compareOutput("./cases/around f g", "around-before-after-all"));
+	}
+
+	it("should fail every test case in a desc whose before_all failed") {
+		assert(compareOutput("./cases/around h", "around-before-all-failure"));
+	}
+
+#ifndef __MINGW32__
+	it("should run before_each and after_each in each case's process with --fork-cases") {
+		assert(compareOutput("./cases/around d --fork-cases", "around-fork-cases"));
+	}
+#endif
 }
 
+#ifndef __MINGW32__
+describe(run) {
+	it("merges the results of several binaries with snow-run") {
+		FILE *f = runcmd("../snow-run/snow-run -q -j 3 cases/tests cases/asserts");
+		assertneq(f, NULL);
+		char line[512];
+		char total[512] = "";
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (strncmp(line, "Total: ", 7) == 0)
+				strcpy(total, line);
+		}
+		int status = pclose(f);
+
+		assertneq(strstr(total, "Total: Passed 28/53 tests in 2 binaries."), NULL);
+		asserteq(WEXITSTATUS(status), EXIT_FAILURE);
+	}
+}
+#endif
+
 snow_main();
 #endif